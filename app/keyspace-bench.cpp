@@ -0,0 +1,124 @@
+#include <redisx/core/keyspace.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <ctime>
+#endif
+
+using namespace redisx;
+
+// Grows one shard's Keyspace from empty to N keys and times every insert, once
+// with incremental rehashing and once finishing each rehash inside the insert
+// that starts it (what a stop-the-world resize costs). The tail is what matters:
+// the mean hardly changes, the worst insert does.
+//
+// With --max-us it is a test instead: only the incremental run, failing if any
+// insert took longer than that of this thread's CPU time, which, unlike the wall
+// clock, does not count the time the thread was not scheduled. It does count the
+// kernel's own pauses, such as a page fault that stops to reclaim memory, which
+// strike at random; so a slow insert fails the test only if it is slow again in
+// a second run, as the work of a rehash always is.
+
+struct Options {
+    size_t keys = 50'000'000;
+    double max_us = 0;          // 0: no limit; compare both ways
+};
+
+struct Result {
+    double total_s = 0;
+    double max_us = 0;
+    double max_cpu_us = 0;
+    size_t over_10us = 0;
+    size_t over_1ms = 0;
+    size_t resizes = 0;
+    std::vector<size_t> slow;   // inserts over Options::max_us of CPU time
+};
+
+// This thread's CPU time where there is such a clock, otherwise wall time
+static double cpu_us() {
+#ifdef _WIN32
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return double(t.tv_sec) * 1e6 + double(t.tv_nsec) / 1e3;
+#endif
+}
+
+static Result run(bool incremental, const Options& o) {
+    using Clock = std::chrono::steady_clock;
+    SlabArena arena;
+    Keyspace keys(arena);
+    Result r;
+    std::string key = "key:";
+    size_t cap = 0;
+
+    const auto t0 = Clock::now();
+    for (size_t i = 0; i < o.keys; ++i) {
+        key.resize(4);
+        key += std::to_string(i);
+        const auto a = Clock::now();
+        const double cpu = cpu_us();
+        keys.emplace(key, Value(ShardString("v", SlabAllocator<char>(arena))));
+        if (!incremental) keys.rehash(SIZE_MAX);
+        const double cpu_used = cpu_us() - cpu;
+        r.max_cpu_us = std::max(r.max_cpu_us, cpu_used);
+        if (o.max_us > 0 && cpu_used > o.max_us) r.slow.push_back(i);
+        const double us = std::chrono::duration<double, std::micro>(Clock::now() - a).count();
+        r.max_us = std::max(r.max_us, us);
+        r.over_10us += us > 10;
+        r.over_1ms += us > 1000;
+        if (keys.capacity() != cap) {
+            cap = keys.capacity();
+            ++r.resizes;
+        }
+    }
+    r.total_s = std::chrono::duration<double>(Clock::now() - t0).count();
+    return r;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--keys" && i + 1 < argc) o.keys = static_cast<size_t>(std::stoull(argv[++i]));
+        else if (a == "--max-us" && i + 1 < argc) o.max_us = std::stod(argv[++i]);
+        else {
+            std::cout << "Usage: redisx-keyspace-bench [--keys N] [--max-us US]\n";
+            return a == "--help" || a == "-?" ? 0 : 1;
+        }
+    }
+
+    std::cout << "growing one keyspace from 0 to " << o.keys << " keys\n\n";
+    std::cout << std::left << std::setw(13) << "rehash" << std::right
+        << std::setw(10) << "ns/insert" << std::setw(14) << "max insert"
+        << std::setw(11) << "> 10 us" << std::setw(9) << "> 1 ms" << std::setw(10) << "resizes" << "\n";
+
+    for (auto [incremental, name] : { std::pair{ true, "incremental" }, std::pair{ false, "all at once" } }) {
+        if (!incremental && o.max_us > 0) break;
+        Result r = run(incremental, o);
+        std::cout << std::left << std::setw(13) << name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << r.total_s * 1e9 / double(o.keys)
+            << std::setw(11) << r.max_us << " us"
+            << std::setw(11) << r.over_10us
+            << std::setw(9) << r.over_1ms
+            << std::setw(10) << r.resizes << "\n";
+        if (o.max_us > 0) {
+            std::cout << "\nworst insert: " << r.max_cpu_us << " us of CPU time (limit " << o.max_us << " us)\n";
+            if (r.slow.empty()) return 0;
+            const Result again = run(true, o);
+            std::vector<size_t> both;
+            std::set_intersection(r.slow.begin(), r.slow.end(), again.slow.begin(), again.slow.end(), std::back_inserter(both));
+            std::cout << r.slow.size() << " over the limit, " << both.size() << " of them again in a second run\n";
+            return both.empty() ? 0 : 1;
+        }
+    }
+    return 0;
+}
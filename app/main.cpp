@@ -1,20 +1,76 @@
 #include <asio.hpp>
 #include <iostream>
 #include <chrono>
-#include <thread>                      // <-- add this
+#include <filesystem>
+#include <thread>
 #include <algorithm>
-#include <redisx/util/thread_pool.hpp>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <memory>
+#include <vector>
+#include <redisx/util/shard_pool.hpp>
 #include <redisx/core/store.hpp>
+#include <redisx/core/expire_cycle.hpp>
 #include <redisx/core/router.hpp>
 #include <redisx/net/server.hpp>
+#include <redisx/persistence/aof.hpp>
+#include <redisx/persistence/snapshot.hpp>
 
 using namespace redisx;
 
+// A whole decimal number that fits in T; false for anything else.
+template <class T>
+static bool parse_number(std::string_view s, T& out) {
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && end == s.data() + s.size();
+}
+
+// Byte counts as Redis spells them: 1k = 1000, 1kb = 1024, and likewise m/mb, g/gb.
+static bool parse_memory(std::string s, size_t& out) {
+    static constexpr std::pair<const char*, size_t> kUnits[] = {
+        { "gb", 1ull << 30 }, { "mb", 1ull << 20 }, { "kb", 1ull << 10 },
+        { "g", 1000000000 }, { "m", 1000000 }, { "k", 1000 }, { "b", 1 },
+    };
+    for (auto& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    size_t unit = 1;
+    for (auto [suffix, mult] : kUnits) {
+        std::string_view sv(suffix);
+        if (s.size() > sv.size() && s.compare(s.size() - sv.size(), sv.size(), sv) == 0) {
+            s.resize(s.size() - sv.size());
+            unit = mult;
+            break;
+        }
+    }
+    size_t n = 0;
+    if (!parse_number(s, n) || n > std::numeric_limits<size_t>::max() / unit) return false;
+    out = n * unit;
+    return true;
+}
+
 int main(int argc, char** argv) {
     uint16_t port = 6379;
     size_t shards = 0; // 0 => auto = hardware_concurrency()
+    size_t io_threads = 1;
+    ttl::Engine expiry = ttl::Engine::Heap;
+    bool shared_reads = false;
+    size_t maxmemory = 0;   // 0 => no limit
+    EvictPolicy policy = EvictPolicy::NoEviction;
+    HashLimits hash_limits;
+    std::string dir = ".";
+    std::string dbfilename = "dump.rdx";
+    bool appendonly = false;
+    std::string appendfilename = "appendonly.aof";
+    Fsync appendfsync = Fsync::EverySec;
+    unsigned aof_rewrite_percentage = 100;
+    size_t aof_rewrite_min_size = 64ull << 20;
 
-    // simple arg parsing: --port/-p, --shards
+    // simple arg parsing: --port/-p, --shards, --io-threads, --expiry, --shared-reads,
+    // --maxmemory, --maxmemory-policy, --hash-max-entries, --hash-max-value, --dir, --dbfilename,
+    // --appendonly, --appendfilename, --appendfsync, --auto-aof-rewrite-percentage, --auto-aof-rewrite-min-size
     for (int i = 1; i < argc; ++i) {
         std::string a = argv[i];
         if ((a == "--port" || a == "-p") && i + 1 < argc) {
@@ -23,8 +79,91 @@ int main(int argc, char** argv) {
         else if (a == "--shards" && i + 1 < argc) {
             shards = static_cast<size_t>(std::stoull(argv[++i]));
         }
+        else if (a == "--io-threads" && i + 1 < argc) {
+            if (!parse_number(argv[++i], io_threads)) {
+                std::cerr << "--io-threads takes a number of threads\n";
+                return 1;
+            }
+            io_threads = std::max<size_t>(1, io_threads);
+        }
+        else if (a == "--expiry" && i + 1 < argc) {
+            std::string e = argv[++i];
+            if (e == "heap") expiry = ttl::Engine::Heap;
+            else if (e == "wheel") expiry = ttl::Engine::Wheel;
+            else {
+                std::cerr << "--expiry must be heap or wheel\n";
+                return 1;
+            }
+        }
+        else if (a == "--shared-reads") {
+            shared_reads = true;
+        }
+        else if (a == "--maxmemory" && i + 1 < argc) {
+            if (!parse_memory(argv[++i], maxmemory)) {
+                std::cerr << "--maxmemory takes bytes, optionally with a k/kb/m/mb/g/gb suffix\n";
+                return 1;
+            }
+        }
+        else if (a == "--maxmemory-policy" && i + 1 < argc) {
+            if (!parse_evict_policy(argv[++i], policy)) {
+                std::cerr << "--maxmemory-policy must be noeviction, allkeys-lru, allkeys-lfu, volatile-lru or volatile-ttl\n";
+                return 1;
+            }
+        }
+        else if (a == "--hash-max-entries" && i + 1 < argc) {
+            if (!parse_number(argv[++i], hash_limits.max_entries)) {
+                std::cerr << "--hash-max-entries takes a number of fields\n";
+                return 1;
+            }
+        }
+        else if (a == "--hash-max-value" && i + 1 < argc) {
+            if (!parse_number(argv[++i], hash_limits.max_value)) {
+                std::cerr << "--hash-max-value takes a number of bytes\n";
+                return 1;
+            }
+        }
+        else if (a == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        }
+        else if (a == "--dbfilename" && i + 1 < argc) {
+            dbfilename = argv[++i];
+        }
+        else if (a == "--appendonly" && i + 1 < argc) {
+            const std::string v = argv[++i];
+            if (v != "yes" && v != "no") {
+                std::cerr << "--appendonly must be yes or no\n";
+                return 1;
+            }
+            appendonly = v == "yes";
+        }
+        else if (a == "--appendfilename" && i + 1 < argc) {
+            appendfilename = argv[++i];
+        }
+        else if (a == "--appendfsync" && i + 1 < argc) {
+            if (!parse_fsync(argv[++i], appendfsync)) {
+                std::cerr << "--appendfsync must be always, everysec or no\n";
+                return 1;
+            }
+        }
+        else if (a == "--auto-aof-rewrite-percentage" && i + 1 < argc) {
+            if (!parse_number(argv[++i], aof_rewrite_percentage)) {
+                std::cerr << "--auto-aof-rewrite-percentage takes a percentage (0 turns automatic rewrites off)\n";
+                return 1;
+            }
+        }
+        else if (a == "--auto-aof-rewrite-min-size" && i + 1 < argc) {
+            if (!parse_memory(argv[++i], aof_rewrite_min_size)) {
+                std::cerr << "--auto-aof-rewrite-min-size takes bytes, optionally with a k/kb/m/mb/g/gb suffix\n";
+                return 1;
+            }
+        }
         else if (a == "--help" || a == "-?") {
-            std::cout << "Usage: redisx-server [--port N] [--shards N]\n";
+            std::cout << "Usage: redisx-server [--port N] [--shards N] [--io-threads N] [--expiry heap|wheel] [--shared-reads]\n"
+                         "                     [--maxmemory BYTES] [--maxmemory-policy POLICY]\n"
+                         "                     [--hash-max-entries N] [--hash-max-value BYTES]\n"
+                         "                     [--dir DIR] [--dbfilename NAME]\n"
+                         "                     [--appendonly yes|no] [--appendfilename NAME] [--appendfsync always|everysec|no]\n"
+                         "                     [--auto-aof-rewrite-percentage N] [--auto-aof-rewrite-min-size BYTES]\n";
             return 0;
         }
         else if (i == 1 && a.find_first_not_of("0123456789") == std::string::npos) {
@@ -39,32 +178,91 @@ int main(int argc, char** argv) {
         shards = hc;
     }
 
-    asio::io_context io;
+    // One io_context per I/O thread; context 0 runs on this thread. Connections stay
+    // on the context that accepted them.
+    std::vector<std::unique_ptr<asio::io_context>> ios;
+    std::vector<asio::executor_work_guard<asio::io_context::executor_type>> keep_running;
+    for (size_t i = 0; i < io_threads; ++i) {
+        ios.push_back(std::make_unique<asio::io_context>(1));
+        keep_running.push_back(asio::make_work_guard(*ios.back()));
+    }
+    asio::io_context& io = *ios[0];
+
+    // hot-path clock for expiry checks, refreshed every millisecond
+    ttl::CoarseTicker coarse_clock;
 
-    // keep one thread for Asio, rest for workers
-    unsigned hc = std::max(1u, std::thread::hardware_concurrency());
-    ThreadPool pool(std::max(1u, hc > 1 ? hc - 1 : 1));
+    // one thread per shard (single writer)
+    Store store(shards, expiry, shared_reads);
+    store.set_maxmemory(maxmemory, policy);
+    store.set_hash_limits(hash_limits);
+    ShardPool pool(store.shard_count());
+
+    // Warm start before anything is served: from the append-only file if there is
+    // one, as it has every write, else from the last snapshot
+    Snapshot snapshot(store, pool, (std::filesystem::path(dir) / dbfilename).string());
+    std::unique_ptr<AppendLog> aof;
+    if (appendonly) aof = std::make_unique<AppendLog>(store, pool, (std::filesystem::path(dir) / appendfilename).string(), appendfsync);
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        std::string error;
+        if (aof && aof->exists()) {
+            size_t commands = 0;
+            if (!aof->replay(commands, error)) {
+                std::cerr << "cannot load append-only file: " << error << "\n";
+                return 1;
+            }
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - t0;
+            std::cout << "replayed " << commands << " commands from " << aof->path() << " in " << took.count() << " s\n";
+        }
+        else {
+            size_t loaded = 0;
+            if (!snapshot.load(loaded, error)) {
+                std::cerr << "cannot load snapshot: " << error << "\n";
+                return 1;
+            }
+            if (loaded) {
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - t0;
+                std::cout << "loaded " << loaded << " keys from " << snapshot.path() << " in " << took.count() << " s\n";
+            }
+        }
+        if (aof) aof->set_auto_rewrite(aof_rewrite_percentage, aof_rewrite_min_size);
+        if (aof && !aof->open(error)) {
+            std::cerr << "cannot open append-only file: " << error << "\n";
+            return 1;
+        }
+    }
+    Router router(store, pool, &snapshot, aof.get());
 
-    Store store(shards);
-    Router router(store);
-    Server server(io, port, router, pool);
+    std::vector<std::unique_ptr<Server>> servers;
+    if (io_threads > 1 && Server::reuse_port_supported()) {
+        for (auto& ctx : ios) servers.push_back(std::make_unique<Server>(*ctx, port, router, /*reuse_port=*/true));
+    }
+    else {
+        servers.push_back(std::make_unique<Server>(io, port, router));
+        if (io_threads > 1) {
+            std::vector<asio::io_context*> targets;
+            for (auto& ctx : ios) targets.push_back(ctx.get());
+            servers.back()->spread_over(std::move(targets));
+        }
+    }
 
-    // TTL sweep timer
-    asio::steady_timer timer{ io };
-    auto arm = [&](auto&& self) -> void {
-        timer.expires_after(std::chrono::milliseconds(200));
-        timer.async_wait([&](const asio::error_code& ec) {
-            if (ec) return;
-            store.sweep_all();
-            self(self);
-            });
-        };
-    arm(arm);
+    // Active expiry: each shard runs its own time-budgeted cycle on its own thread
+    std::vector<std::unique_ptr<ExpireCycle>> expire_cycles;
+    for (size_t i = 0; i < store.shard_count(); ++i) {
+        expire_cycles.push_back(std::make_unique<ExpireCycle>(pool.context(i), store.shard_by_index(i)));
+        expire_cycles.back()->start();
+    }
 
     std::cout << "redisx RESP server on " << port
-        << " with " << shards << " shard" << (shards == 1 ? "" : "s") << " ...\n";
+        << " with " << shards << " shard" << (shards == 1 ? "" : "s")
+        << " and " << io_threads << " I/O thread" << (io_threads == 1 ? "" : "s") << " ...\n";
 
+    std::vector<std::thread> io_pool;
+    for (size_t i = 1; i < ios.size(); ++i) {
+        io_pool.emplace_back([ctx = ios[i].get()] { ctx->run(); });
+    }
     io.run();
+    for (auto& t : io_pool) t.join();
     return 0;
 }
 
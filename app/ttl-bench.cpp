@@ -0,0 +1,117 @@
+#include <redisx/time/ttl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace redisx;
+
+// Refresh-heavy TTL churn against one ttl::Index, on a simulated clock so both
+// engines see the same schedule. Every operation re-arms the TTL of a live session
+// picked at random; the set of live sessions slides forward, so sessions that fall
+// out of it stop being refreshed and expire through the periodic sweep.
+
+struct Options {
+    size_t sessions = 1'000'000;   // live sessions at any time
+    size_t ops = 20'000'000;       // TTL refreshes
+    long long ttl_ms = 5'000;      // TTL set by each refresh
+    long long op_ns = 1'000;       // simulated time per refresh (1M refreshes/s)
+    size_t slide_every = 100;      // one new session (and one abandoned) per N ops
+    long long sweep_ms = 200;      // sweep period, as in redisx-server
+};
+
+struct Result {
+    double set_s = 0;
+    double sweep_s = 0;
+    double max_sweep_ms = 0;
+    size_t expired = 0;
+    size_t tracked = 0;
+};
+
+static Result run(ttl::Engine engine, const Options& o, const std::vector<std::string>& keys) {
+    using Wall = std::chrono::steady_clock;
+    ttl::Index index(engine);
+    std::mt19937_64 rng(42);
+    Result r;
+
+    const auto base = ttl::now();
+    auto sim = base;
+    auto next_sweep = base + ttl::Ms(o.sweep_ms);
+    size_t window = 0;
+
+    auto on_expire = [&](const std::string&) { ++r.expired; };
+    auto sweep = [&] {
+        auto w0 = Wall::now();
+        index.sweep_due(sim, on_expire);
+        std::chrono::duration<double> d = Wall::now() - w0;
+        r.sweep_s += d.count();
+        r.max_sweep_ms = std::max(r.max_sweep_ms, d.count() * 1e3);
+    };
+
+    auto w0 = Wall::now();
+    for (size_t i = 0; i < o.ops; ++i) {
+        if (i % o.slide_every == 0) ++window;
+        const auto& key = keys[(window + rng() % o.sessions) % keys.size()];
+        index.set(key, sim + ttl::Ms(o.ttl_ms));
+        sim += std::chrono::nanoseconds(o.op_ns);
+        if (sim >= next_sweep) {
+            // keep sweeps out of the refresh timing
+            r.set_s += std::chrono::duration<double>(Wall::now() - w0).count();
+            sweep();
+            next_sweep += ttl::Ms(o.sweep_ms);
+            w0 = Wall::now();
+        }
+    }
+    r.set_s += std::chrono::duration<double>(Wall::now() - w0).count();
+
+    // let every remaining TTL run out (untimed; it is one huge sweep)
+    sim += ttl::Ms(o.ttl_ms + 1);
+    index.sweep_due(sim, on_expire);
+    r.tracked = index.size();
+    return r;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&] { return std::stoll(argv[++i]); };
+        if (a == "--sessions" && i + 1 < argc) o.sessions = static_cast<size_t>(next());
+        else if (a == "--ops" && i + 1 < argc) o.ops = static_cast<size_t>(next());
+        else if (a == "--ttl-ms" && i + 1 < argc) o.ttl_ms = next();
+        else if (a == "--op-ns" && i + 1 < argc) o.op_ns = next();
+        else {
+            std::cout << "Usage: redisx-ttl-bench [--sessions N] [--ops N] [--ttl-ms N] [--op-ns N]\n";
+            return a == "--help" || a == "-?" ? 0 : 1;
+        }
+    }
+    o.sessions = std::max<size_t>(1, o.sessions);
+
+    // every session that is ever live, so key building stays out of the timings
+    std::vector<std::string> keys(o.sessions + o.ops / o.slide_every + 1);
+    for (size_t i = 0; i < keys.size(); ++i) keys[i] = "session:" + std::to_string(i);
+
+    std::cout << o.ops << " refreshes over " << o.sessions << " live sessions, TTL "
+        << o.ttl_ms << " ms, sweep every " << o.sweep_ms << " ms\n\n";
+    std::cout << std::left << std::setw(8) << "engine" << std::right
+        << std::setw(12) << "ns/set" << std::setw(14) << "sweep total"
+        << std::setw(12) << "max sweep" << std::setw(12) << "expired" << "\n";
+
+    for (auto [engine, name] : { std::pair{ ttl::Engine::Heap, "heap" }, std::pair{ ttl::Engine::Wheel, "wheel" } }) {
+        Result r = run(engine, o, keys);
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << r.set_s * 1e9 / double(o.ops)
+            << std::setw(11) << r.sweep_s * 1e3 << " ms"
+            << std::setw(9) << r.max_sweep_ms << " ms"
+            << std::setw(12) << r.expired << "\n";
+        if (r.tracked != 0) {
+            std::cerr << name << ": " << r.tracked << " keys still tracked after every TTL ran out\n";
+            return 1;
+        }
+    }
+    return 0;
+}
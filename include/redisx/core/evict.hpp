@@ -0,0 +1,60 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <redisx/core/keyspace.hpp>
+
+namespace redisx {
+
+	// Which keys may go once a shard is over its memory limit (Redis' maxmemory-policy).
+	enum class EvictPolicy { NoEviction, AllKeysLru, AllKeysLfu, VolatileLru, VolatileTtl };
+
+	// Parses a policy name such as "allkeys-lru"; false if unknown.
+	bool parse_evict_policy(std::string_view name, EvictPolicy& out);
+
+	// Approximate LRU/LFU eviction for one shard, after Redis: each round samples a
+	// few keys from a random spot in the keyspace into a small pool of the best
+	// candidates seen so far, and the best one still present is evicted.
+	//
+	// Entry::access holds the per-key state the score is built from: the last
+	// access in seconds for the LRU policies; for LFU, the minute of the last
+	// access in the high 24 bits and an 8-bit logarithmic access counter that
+	// decays by one per idle minute.
+	class Evictor {
+	public:
+		using TimePoint = std::chrono::steady_clock::time_point;
+		static constexpr size_t kSamples = 5;       // keys per round (maxmemory-samples)
+		static constexpr size_t kPoolSize = 16;
+		static constexpr size_t kMaxScan = 1024;    // slots a round may visit looking for keys with a TTL
+
+		explicit Evictor(EvictPolicy policy = EvictPolicy::NoEviction) : policy_(policy) {}
+
+		EvictPolicy policy() const { return policy_; }
+		// Whether the policy needs Entry::access kept up to date
+		bool tracks_access() const {
+			return policy_ == EvictPolicy::AllKeysLru || policy_ == EvictPolicy::AllKeysLfu || policy_ == EvictPolicy::VolatileLru;
+		}
+		// Entry::access for a new key, and its new value when a key holding a is accessed
+		uint32_t initial(TimePoint now) const;
+		uint32_t touched(uint32_t a, TimePoint now) const;
+
+		// The next key to evict, or nullptr if the policy allows none.
+		Entry* next_victim(const Keyspace& keys, TimePoint now);
+
+	private:
+		struct Candidate {
+			uint64_t score;             // higher goes first
+			std::string key;
+		};
+		bool eligible(const Entry& e) const;
+		uint64_t score(const Entry& e, TimePoint now) const;
+		void populate(const Keyspace& keys, TimePoint now);
+
+		EvictPolicy policy_;
+		std::vector<Candidate> pool_;   // ascending score, best at the back
+		uint64_t rng_ = 0x9E3779B97F4A7C15ULL;
+	};
+
+} // namespace redisx
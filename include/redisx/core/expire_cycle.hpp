@@ -0,0 +1,42 @@
+#pragma once
+#include <asio.hpp>
+#include <chrono>
+#include <redisx/core/store.hpp>
+
+namespace redisx {
+
+	// Active expiration for one shard, in the spirit of Redis's activeExpireCycle.
+	// Runs on the shard's own executor, so it never races the shard's commands and
+	// never stalls another shard. Each run expires due keys for at most kBudget. A
+	// run that used up its budget with keys still due queues the next one straight
+	// behind the commands already waiting, instead of sleeping kPeriod, so a backlog
+	// drains quickly while no command waits more than one slice. As in Redis's slow
+	// cycle, the runs of one period take at most kMaxPerPeriod between them: a
+	// backlog beyond that waits for the next period, so the shard's thread always
+	// has most of its time for commands. Budget left after expiring goes to the
+	// keyspace's rehash, if one is under way.
+	class ExpireCycle {
+	public:
+		using Duration = std::chrono::steady_clock::duration;
+		using TimePoint = std::chrono::steady_clock::time_point;
+		static constexpr Duration kPeriod = std::chrono::milliseconds(100);
+		static constexpr Duration kBudget = std::chrono::microseconds(250);
+		static constexpr Duration kMaxPerPeriod = kPeriod / 4;      // 25%, Redis's ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC
+
+		ExpireCycle(asio::io_context& shard_ctx, Shard& shard) : timer_(shard_ctx), shard_(shard) {}
+		ExpireCycle(const ExpireCycle&) = delete;
+		ExpireCycle& operator=(const ExpireCycle&) = delete;
+
+		void start() { arm(std::chrono::steady_clock::now() + kPeriod); }
+
+	private:
+		void arm(TimePoint at);
+		void run();
+
+		asio::steady_timer timer_;
+		Shard& shard_;
+		TimePoint period_start_{};
+		Duration used_{};               // by the runs since period_start_
+	};
+
+} // namespace redisx
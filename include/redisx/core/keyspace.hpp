@@ -0,0 +1,328 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <redisx/proto/resp.hpp>
+#include <redisx/util/epoch.hpp>
+#include <redisx/util/slab.hpp>
+#include <redisx/util/string_map.hpp>
+
+namespace redisx {
+
+	enum class ValueType { None, String, Hash };
+
+	// Keys, strings and hashes live in their shard's SlabArena.
+	using ShardString = std::basic_string<char, std::char_traits<char>, SlabAllocator<char>>;
+
+	// Past these a packed hash is converted to a table (see HashValue).
+	struct HashLimits {
+		size_t max_entries = 128;
+		size_t max_value = 64;      // bytes, for fields and values alike
+	};
+
+	// A hash value. Small hashes are packed: every field and value as a varint
+	// length and its bytes, pair after pair, in one arena block searched linearly.
+	// The first write past the HashLimits converts it to a hash table for good.
+	class HashValue {
+	public:
+		using Table = std::unordered_map<ShardString, ShardString, StringHash, std::equal_to<>,
+			SlabAllocator<std::pair<const ShardString, ShardString>>>;
+
+		explicit HashValue(SlabArena& arena) : arena_(&arena) {}
+		HashValue(const HashValue& o);      // in the same arena
+		HashValue& operator=(const HashValue&) = delete;
+		~HashValue();
+
+		bool packed() const { return !converted_; }
+		size_t size() const { return converted_ ? table_->size() : count_; }
+		bool empty() const { return size() == 0; }
+
+		// The view is valid until the hash is next written.
+		std::optional<std::string_view> find(std::string_view field) const;
+		// true if field is new
+		bool set(std::string_view field, std::string_view value, const HashLimits& limits);
+		// true if field was there
+		bool erase(std::string_view field);
+
+		// f(field, value) for every pair, in no particular order
+		template <class F>
+		void for_each(F&& f) const {
+			if (converted_) {
+				for (auto& [k, v] : *table_) f(std::string_view(k), std::string_view(v));
+				return;
+			}
+			for (const char *p = buf_, *end = buf_ + len_; p != end;) {
+				std::string_view k = read(p);
+				f(k, read(p));
+			}
+		}
+
+	private:
+		// The length-prefixed string at p; advances p past it.
+		static std::string_view read(const char*& p) {
+			size_t n = 0;
+			for (int shift = 0;; shift += 7) {
+				const auto b = static_cast<unsigned char>(*p++);
+				n |= size_t(b & 0x7f) << shift;
+				if (b < 0x80) break;
+			}
+			std::string_view s(p, n);
+			p += n;
+			return s;
+		}
+		size_t find_packed(std::string_view field) const;      // offset of the pair, or len_
+		void put_packed(size_t at, std::string_view field, std::string_view value);
+		void grow(size_t n);
+		void convert();
+
+		// 32 bytes, so as small a block as the arena has room for
+		SlabArena* arena_;
+		union {
+			char* buf_ = nullptr;   // packed pairs
+			Table* table_;          // once converted
+		};
+		uint32_t len_ = 0;
+		uint32_t cap_ = 0;
+		uint32_t count_ = 0;
+		bool converted_ = false;
+	};
+
+	// Tagged value; Entry::type() maps each alternative to its ValueType. New types
+	// are new alternatives; large ones go behind a pointer to keep entries small.
+	// Long strings are held as SharedBytes, which GET replies send by reference.
+	using Value = std::variant<ShardString, SlabPtr<HashValue>, SharedBytes>;
+
+	// Strings at least this long are stored shared rather than inline.
+	inline constexpr size_t kSharedStringMin = 16 * 1024;
+
+	// A string value in arena; a shared one is charged to it for as long as the
+	// buffer lives, including while replies are still sending it.
+	Value string_value(std::string_view s, SlabArena& arena);
+	SlabPtr<HashValue> hash_value(SlabArena& arena, const HashValue* copy_of = nullptr);
+
+	// One key of the keyspace: the key, its value and its deadline, in one allocation.
+	struct Entry {
+		using TimePoint = std::chrono::steady_clock::time_point;
+		static constexpr TimePoint kNoExpiry = TimePoint::max();
+
+		ShardString key;
+		Value value;
+		TimePoint expires = kNoExpiry;   // kNoExpiry compares after any real "now"
+		uint32_t access = 0;             // eviction state, see Evictor
+
+		bool has_expiry() const { return expires != kNoExpiry; }
+		ValueType type() const {
+			static constexpr ValueType kTypes[] = { ValueType::String, ValueType::Hash, ValueType::String };
+			return kTypes[value.index()];
+		}
+		// Strings are immutable in place (SET replaces the value); nullopt if not a string.
+		std::optional<std::string_view> str() const {
+			if (auto* s = std::get_if<ShardString>(&value)) return std::string_view(*s);
+			if (auto* b = shared_str()) return std::string_view(**b);
+			return std::nullopt;
+		}
+		// The buffer of a string stored shared; nullptr if it is inline (or not a string).
+		const SharedBytes* shared_str() const { return std::get_if<SharedBytes>(&value); }
+		HashValue* hash() {
+			auto* p = std::get_if<SlabPtr<HashValue>>(&value);
+			return p ? p->get() : nullptr;
+		}
+		const HashValue* hash() const { return const_cast<Entry*>(this)->hash(); }
+
+		// The deadline is the one field a shared Keyspace changes in place, so the
+		// owner writes it with set_expires() and other threads read shared_expires().
+		void set_expires(TimePoint tp) { std::atomic_ref<TimePoint>(expires).store(tp, std::memory_order_relaxed); }
+		TimePoint shared_expires() const {
+			return std::atomic_ref<TimePoint>(const_cast<TimePoint&>(expires)).load(std::memory_order_relaxed);
+		}
+		// Access state is written on reads too, possibly by shared readers, so always atomically.
+		uint32_t load_access() const {
+			return std::atomic_ref<uint32_t>(const_cast<uint32_t&>(access)).load(std::memory_order_relaxed);
+		}
+		void store_access(uint32_t a) const {
+			std::atomic_ref<uint32_t>(const_cast<uint32_t&>(access)).store(a, std::memory_order_relaxed);
+		}
+	};
+
+	// Open-addressing table of Entry pointers in the Swiss-table layout: one control
+	// byte per slot (empty, deleted, or 7 bits of the key's hash) scanned 16 at a
+	// time, so a probe touches one cache line of metadata and dereferences an entry
+	// only on a tag match. Owns its entries. Single-threaded, like the shard using it.
+	//
+	// Shared mode (given an EpochDomain) additionally lets other threads
+	// look keys up with find_shared() while the owner writes: published entries are
+	// never changed in place except for their deadline, so values are replaced with
+	// assign(), and unlinked entries and outgrown arrays are retired to the domain
+	// instead of freed.
+	//
+	// Growing is incremental, as in Redis's dict: the outgrown arrays stay in use
+	// while their entries are copied to the new ones a group at a time on every
+	// write, and by rehash() while the owner is idle, so no single call pays for a
+	// full rehash. Lookups try the new arrays, then the old ones. Once spent, the
+	// old arrays' pages go back to the system the same way, a few per call.
+	//
+	// Entries and the table arrays are allocated from the arena, whose owner thread
+	// must be the one writing.
+	class Keyspace {
+	public:
+		explicit Keyspace(SlabArena& arena, EpochDomain* shared = nullptr)
+			: arena_(arena), retired_(shared ? std::make_unique<RetireList>(*shared) : nullptr) {}
+		~Keyspace();
+		Keyspace(const Keyspace&) = delete;
+		Keyspace& operator=(const Keyspace&) = delete;
+
+		size_t size() const { return size_; }
+		size_t capacity() const { return cap_; }
+		bool shared() const { return retired_ != nullptr; }
+		bool rehashing() const { return old_cap_ != 0; }
+
+		Entry* find(std::string_view key) const;
+		// Finds key or inserts a new entry holding init (left untouched if the key
+		// exists); second is true if it was inserted.
+		std::pair<Entry*, bool> emplace(std::string_view key, Value&& init);
+		// Replaces e's value; in shared mode e is swapped for a new entry, which is
+		// returned, and must not be used afterwards.
+		Entry* assign(Entry* e, Value v);
+		bool erase(std::string_view key);
+		void erase(Entry* e);            // e must belong to this keyspace
+		void clear();
+
+		// Shared mode, from any thread, with the domain pinned for as long as the
+		// entry is used. May miss a key being written concurrently.
+		const Entry* find_shared(std::string_view key) const;
+		// Shared mode: frees retired memory no reader can still reach.
+		void reclaim() { if (retired_) retired_->reclaim(); }
+		// Copies up to n slots' worth of an unfinished rehash, or else gives back n
+		// pages of the arrays a finished one outgrew; true if some are left.
+		bool rehash(size_t n);
+		// Grows the table at once so that it holds n entries without growing again.
+		void reserve(size_t n);
+
+		template <class F>
+		void for_each(F&& f) const {
+			for (size_t i = 0; i < cap_; ++i) {
+				if (ctrl_[i] >= 0) f(*slots_[i]);
+			}
+			for (size_t j = migrated_; j < old_cap_; ++j) {
+				if (old_ctrl_[j] >= 0) f(*old_slots_[j]);
+			}
+		}
+
+		// Visits the entries of up to max_slots consecutive slots from start (wrapping),
+		// until f returns false; for sampling keys from a random spot. While rehashing,
+		// the slots are those of the old arrays not copied yet or of the new arrays,
+		// picked (by start's high bits) in proportion to the entries in each.
+		template <class F>
+		void scan_from(size_t start, size_t max_slots, F&& f) const {
+			if (old_left_ != 0 && (start >> 32) % size_ < old_left_) {
+				scan(old_ctrl_.get(), old_slots_.get(), migrated_, old_cap_, start, max_slots, f);
+			}
+			else {
+				scan(ctrl_.get(), slots_.get(), 0, cap_, start, max_slots, f);
+			}
+		}
+
+		// Erases every entry pred returns true for; returns how many were erased.
+		template <class P>
+		size_t erase_if(P&& pred) {
+			rehash(SIZE_MAX);
+			size_t n = 0;
+			for (size_t i = 0; i < cap_; ++i) {
+				if (ctrl_[i] >= 0 && pred(*slots_[i])) {
+					erase_at(i);
+					++n;
+				}
+			}
+			return n;
+		}
+
+	private:
+		static constexpr size_t kGroupWidth = 16;
+		static constexpr int8_t kEmpty = -128;
+		static constexpr int8_t kDeleted = -2;
+		static constexpr size_t kRehashStep = kGroupWidth;     // slots copied per write
+		static constexpr size_t kPrepareStep = 64;             // control bytes set per insert
+		static constexpr size_t kPrepareMin = 64 * 1024;       // below this, resize() just does it
+		static constexpr size_t kReleasePage = 4096;           // bytes of spent arrays per page given back
+
+		// The arrays as published to find_shared(), and the outgrown ones while rehashing
+		struct View {
+			size_t cap;
+			int8_t* ctrl;
+			Entry** slots;
+			size_t old_cap;
+			int8_t* old_ctrl;
+			Entry** old_slots;
+		};
+		// Outgrown arrays, retired whole in shared mode
+		struct OldTable {
+			SlabArray<int8_t> ctrl;
+			SlabArray<Entry*> slots;
+			std::unique_ptr<View> view;
+		};
+
+		// The slot in ctrl[0, cap) for which is(slot) holds; cap if there is none.
+		template <class Is>
+		static size_t probe(const int8_t* ctrl, size_t cap, uint64_t h, Is&& is);
+		static const Entry* probe_shared(const int8_t* ctrl, Entry* const* slots, size_t cap, std::string_view key, uint64_t h);
+		template <class F>
+		static void scan(const int8_t* ctrl, Entry* const* slots, size_t from, size_t to, size_t start, size_t max_slots, F& f) {
+			for (size_t n = 0; n < max_slots && n < to - from; ++n) {
+				const size_t i = from + (start + n) % (to - from);
+				if (ctrl[i] >= 0 && !f(static_cast<const Entry&>(*slots[i]))) return;
+			}
+		}
+
+		Entry* find(std::string_view key, uint64_t h) const;
+		void erase_at(size_t i);
+		void resize(size_t new_cap);
+		void prepare_growth();
+		void spend(SlabArray<int8_t> ctrl, SlabArray<Entry*> slots);
+		bool release_spent(size_t pages);
+		Entry* new_entry(std::string_view key, Value&& v, Entry::TimePoint expires);
+		void free_entry(Entry* e);
+		// Every store a shared reader may observe goes through these
+		static void put_ctrl(int8_t* ctrl, size_t i, int8_t c) { std::atomic_ref<int8_t>(ctrl[i]).store(c, std::memory_order_release); }
+		static void put_slot(Entry** slots, size_t i, Entry* e) { std::atomic_ref<Entry*>(slots[i]).store(e, std::memory_order_release); }
+
+		SlabArena& arena_;
+		SlabArray<int8_t> ctrl_;
+		SlabArray<Entry*> slots_;
+		size_t cap_ = 0;            // 0 or a power of two >= kGroupWidth
+		size_t size_ = 0;
+		size_t growth_left_ = 0;    // inserts into empty slots before a resize
+
+		// The outgrown arrays while rehashing. Slots below migrated_ have been copied
+		// to ctrl_/slots_; until the arrays go, an entry there that is erased or
+		// assigned is changed in both, so readers may find it in either.
+		SlabArray<int8_t> old_ctrl_;
+		SlabArray<Entry*> old_slots_;
+		size_t old_cap_ = 0;
+		size_t migrated_ = 0;
+		size_t old_left_ = 0;       // entries not copied yet
+
+		// Control bytes for doubling, set to empty a little per insert as the table
+		// fills up, so resize() does not have to touch them all at once
+		SlabArray<int8_t> next_ctrl_;
+		size_t next_ready_ = 0;
+
+		// Outgrown arrays no reader can reach any more, given back to the system a
+		// few pages per write so that freeing them costs no call more than that.
+		// Before retired_, whose pending OldTables end up here.
+		SlabArray<int8_t> spent_ctrl_;
+		SlabArray<Entry*> spent_slots_;
+		size_t spent_released_ = 0;     // bytes of spent_slots_, then spent_ctrl_, given back
+
+		std::unique_ptr<RetireList> retired_;       // shared mode only
+		std::atomic<View*> view_{ nullptr };
+	};
+
+} // namespace redisx
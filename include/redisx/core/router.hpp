@@ -1,21 +1,82 @@
 #pragma once
 #include <functional>
+#include <span>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 #include <redisx/core/store.hpp>
+#include <redisx/proto/resp.hpp>
+#include <redisx/util/shard_pool.hpp>
 
 namespace redisx {
 
+	class Router;
+	class Snapshot;
+	class AppendLog;
+
+	// Static description of a command, following Redis' COMMAND INFO conventions.
+	struct CommandSpec {
+		// DenyOom: may add data, so fails with -OOM when its shards have no room left
+		enum Flags : unsigned { Write = 1, ReadOnly = 2, Fast = 4, DenyOom = 8 };
+		// How the per-key replies of a multi-key command are combined across shards.
+		enum class Merge : unsigned char { None, Array, Sum, Ok };
+		using Fn = void (*)(Router&, std::span<const std::string_view>, RespWriter&);
+		// false, having written nothing: the command runs on the shard's thread after all
+		using SharedFn = bool (*)(Router&, std::span<const std::string_view>, RespWriter&);
+
+		std::string_view name;      // upper case
+		int arity;                  // N: exactly N args incl. the name; -N: at least N
+		unsigned flags;
+		int first_key;              // 0: command takes no key
+		int last_key;               // negative: counted from the end (-1 = last arg)
+		int step;
+		Merge merge;
+		std::string_view per_key;   // single-key command each key is split into
+		Fn fn;
+		SharedFn shared_fn = nullptr;   // read run off the shard's thread in shared-read mode
+	};
+
 	class Router {
 	public:
-		using Handler = std::function<std::string(const std::vector<std::string>&)>;
-		explicit Router(Store& s);
+		// Command arguments as views; args[0] is the command name.
+		using Args = std::span<const std::string_view>;
+		using Completion = std::function<void(Reply)>;
+		// snapshot backs SAVE/BGSAVE/LASTSAVE and INFO persistence; without one they
+		// fail. With an append-only log, every write is logged on its shard's thread.
+		Router(Store& s, ShardPool& pool, Snapshot* snapshot = nullptr, AppendLog* aof = nullptr);
+
+		// Case-insensitive lookup in the compile-time command table; nullptr if unknown.
+		static const CommandSpec* lookup(std::string_view name);
+		static std::span<const CommandSpec> commands();
+
+		// Runs the command on the thread owning its key(s) and hands the reply to done.
+		// Multi-key commands are split per shard and their partial replies merged;
+		// key-less commands (PING, ECHO, errors) complete inline on the caller's thread.
+		// The reply is appended to out (typically around a recycled, empty buffer),
+		// which is then handed to done. The memory args point into must stay valid until done
+		// has been called. idle means none of the caller's earlier commands is still
+		// in flight; only then may a read in shared-read mode complete inline too.
+		void execute(std::vector<std::string_view> args, Reply out, Completion done, bool idle = false);
+
+		// Runs the command on the calling thread, appending the reply to w (or out);
+		// the caller must own every shard involved. The string forms copy shared
+		// payloads into the reply text.
+		void dispatch(Args args, RespWriter& w);
+		void dispatch(Args args, Reply& out);
+		std::string dispatch(Args args);
 		std::string dispatch(const std::vector<std::string>& args);
 
+		Store& store() { return store_; }
+		Snapshot* snapshot() { return snapshot_; }
+		AppendLog* append_log() { return aof_; }
+
 	private:
+		void fan_out(const CommandSpec& c, std::vector<std::string_view> args, Reply out, Completion done);
+
 		Store& store_;
-		std::unordered_map<std::string, Handler> h_;
+		ShardPool& pool_;
+		Snapshot* snapshot_;
+		AppendLog* aof_;
 	};
 
 } // namespace redisx
@@ -1,74 +1,187 @@
 #pragma once
-#include <shared_mutex>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
+#include <atomic>
 #include <memory>
 #include <chrono>
-#include <optional>
+#include <span>
+#include <functional>
+#include <redisx/core/evict.hpp>
+#include <redisx/core/keyspace.hpp>
+#include <redisx/time/ttl.hpp>
 
 namespace redisx {
 
-	enum class ValueType { None, String, Hash };
+	// Outcome of a typed lookup; WrongType maps to the -WRONGTYPE reply.
+	enum class OpStatus { Ok, NotFound, WrongType };
 
+	// A shard is owned by exactly one thread (see ShardPool) and every method must be
+	// called from it, so there is no internal locking.
 	class Shard {
 	public:
-		Shard() = default;
+		// With a domain the shard is in shared-read mode (see read_shared).
+		explicit Shard(ttl::Engine expiry = ttl::Engine::Heap, EpochDomain* shared = nullptr)
+			: keys_(arena_, shared), expiry_(expiry), domain_(shared) {}
 		Shard(const Shard&) = delete;
 		Shard& operator=(const Shard&) = delete;
 		Shard(Shard&&) = delete;
 		Shard& operator=(Shard&&) = delete; 
 
+		using TimePoint = std::chrono::steady_clock::time_point;
+
 		// KV
-		std::optional<std::string> get(const std::string& k);
-		void set(const std::string& k, std::string v);
-		bool del(const std::string& k);
+		void set(std::string_view k, std::string_view v);
+		bool del(std::string_view k);
 
 		// TTL
-		void set_expire(const std::string& k, std::chrono::steady_clock::time_point tp);
-		long long ttl_ms(const std::string& k, std::chrono::steady_clock::time_point now);
-		void clear_expire(const std::string& k);
-		void sweep(std::chrono::steady_clock::time_point now);
+		void set_expire(std::string_view k, TimePoint tp, TimePoint now);
+		long long ttl_ms(std::string_view k, TimePoint now);
+		void clear_expire(std::string_view k);
+		// Expires keys due at now, then copies slots of an unfinished keyspace rehash,
+		// until there is nothing left to do or budget has elapsed; returns true if it
+		// stopped on the budget, i.e. there may be more to do.
+		bool sweep(TimePoint now, std::chrono::steady_clock::duration budget);
 
 		// Stores key current value type (treats expired as None)
-		ValueType type_of(const std::string& key, std::chrono::steady_clock::time_point now);
+		ValueType type_of(std::string_view key, TimePoint now);
+
+		// Fused operations: lazy expiry, type check and the operation itself in a single
+		// pass over the key. Pointers handed out refer to the stored value and stay valid
+		// until the next write to this shard.
+
+		// GET: out -> the entry, which holds a string (see Entry::str/shared_str)
+		OpStatus get_string_checked(std::string_view key, TimePoint now, const Entry*& out);
+		// EXPIRE/PEXPIRE: sets the deadline if the key exists, without reading the value;
+		// a deadline not after now deletes the key
+		bool expire_if_exists(std::string_view key, TimePoint tp, TimePoint now);
+		// PERSIST: drops the deadline if the key exists
+		bool persist_if_exists(std::string_view key, TimePoint now);
 
 		// HASHES (all return Redis-like integers/bulk semantics)
 
-		// HSET key field value -> returns 1 if new field, 0 if updated
-		int hset(const std::string& key, const std::string& field, const std::string& value);
-		// HGET key field -> optional value
-		std::optional<std::string> hget(const std::string& key, const std::string& field);
-		// HDEL key field -> returns #fields removed (0 or 1 here)
-		int hdel(const std::string& key, const std::string& field);
-		// HEXISTS key field -> 1/0
-		int hexists(const std::string& key, const std::string& field);
-		// HLEN key -> number of fields
-		long long hlen(const std::string& key);
-		// HGETALL key -> vector of [field, value, field, value, ...]
-		std::vector<std::string> hgetall(const std::string& key);
+		// HGET key field: out -> the field value
+		OpStatus hget_checked(std::string_view key, std::string_view field, TimePoint now, std::string_view& out);
+		// Read access for HLEN/HEXISTS/HMGET/HGETALL: out -> the field map
+		OpStatus hash_checked(std::string_view key, TimePoint now, const HashValue*& out);
+		// HSET key field value [field value ...]: added -> #new fields
+		OpStatus hset_checked(std::string_view key, std::span<const std::string_view> field_values, TimePoint now, long long& added);
+		// HDEL key field [field ...]: removed -> #fields removed; an emptied hash is deleted
+		OpStatus hdel_checked(std::string_view key, std::span<const std::string_view> fields, TimePoint now, long long& removed);
+
+		// Shared-read mode only, and the one method callable from any thread (that
+		// has passed EpochDomain::reader_ready). Looks key up without the owning thread
+		// and returns f(const Entry&), the entry kept alive until f returns. Expired
+		// keys read as NotFound and are left for the owner to erase.
+		template <class F>
+		OpStatus read_shared(std::string_view key, TimePoint now, F&& f) const {
+			EpochDomain::Guard pin(*domain_);
+			const Entry* e = keys_.find_shared(key);
+			if (!e || now >= e->shared_expires()) return OpStatus::NotFound;
+			touch(*e, now);
+			return f(*e);
+		}
+
+		// Snapshots. Visits every key whose deadline is after now, as f(const Entry&).
+		template <class F>
+		void for_each_live(TimePoint now, F&& f) const {
+			keys_.for_each([&](const Entry& e) { if (now < e.expires) f(e); });
+		}
+		size_t key_count() const { return keys_.size(); }
+		// Sizes the keyspace for keys in all before a load restores them.
+		void reserve(size_t keys) { keys_.reserve(keys); }
+		// Adds a key read back from a snapshot, replacing any key of that name.
+		void restore(std::string_view key, std::string_view value, TimePoint deadline, TimePoint now);
+		void restore(std::string_view key, std::span<const std::string_view> field_values, TimePoint deadline, TimePoint now);
+
+		// Memory held by the shard's data; callable from any thread.
+		SlabArena::Stats memory() const { return arena_.stats(); }
+		size_t used_memory() const;
+		// Keys evicted so far; callable from any thread.
+		size_t evicted() const { return evicted_.load(std::memory_order_relaxed); }
+		// Writes so far, counted per key or field changed; callable from any thread.
+		// Loading a snapshot does not count.
+		uint64_t changes() const { return changes_.load(std::memory_order_relaxed); }
+
+		// Caps used_memory() at bytes (0 = no limit). Set before the shard is in use.
+		void set_maxmemory(size_t bytes, EvictPolicy policy);
+		// Called before a command that may add data: evicts keys under the policy
+		// until the shard is within its limit. False if it is over the limit and
+		// the policy leaves nothing to evict, or evicting frees nothing because
+		// shared readers still hold it, in which case the command must fail.
+		bool make_room(TimePoint now);
+
+		// When hashes stop being packed. Set before the shard is in use.
+		void set_hash_limits(const HashLimits& limits) { hash_limits_ = limits; }
+
+		// Called with the key of every entry that goes away without a command naming
+		// it: expired, lazily or by sweep(), or evicted. Set before the shard is in use.
+		using DropHook = std::function<void(std::string_view key)>;
+		void on_drop(DropHook f) { on_drop_ = std::move(f); }
+		// While loading, nothing expires or is evicted: a replayed log records when
+		// that happened itself. Set between uses.
+		void set_loading(bool on) { loading_ = on; }
 
 	private:
-		bool is_expired_unlocked(const std::string& k, std::chrono::steady_clock::time_point now) const;
-
-		mutable std::shared_mutex mu_;
-		// String keys
-		std::unordered_map<std::string, std::string> map_;
-		// Key -> expire time
-		std::unordered_map<std::string, std::chrono::steady_clock::time_point> ttl_;
-		// Hash keys: key -> (field -> value)
-		std::unordered_map<std::string, std::unordered_map<std::string, std::string>> hmap_;
+		// Looks k up, erasing it first if its deadline has passed; nullptr if absent.
+		Entry* find_live(std::string_view k, TimePoint now);
+		void set_deadline(Entry* e, TimePoint tp);
+		void expire_at(Entry* e, std::string_view k, TimePoint tp, TimePoint now);
+		void remove(Entry* e);
+		bool due(const Entry& e, TimePoint now) const { return !loading_ && now >= e.expires; }
+		void dropped(std::string_view key) { if (on_drop_) on_drop_(key); }
+		// Records an access for the eviction policy, if it uses them
+		void touch(const Entry& e, TimePoint now) const {
+			if (!evictor_.tracks_access()) return;
+			const uint32_t a = e.load_access();
+			const uint32_t b = evictor_.touched(a, now);
+			if (b != a) e.store_access(b);      // mostly unchanged: spare the cache line
+		}
+		void track_new(Entry* e, TimePoint now) {
+			if (evictor_.tracks_access()) e->store_access(evictor_.initial(now));
+		}
+		// Only the owner writes the counter, so no read-modify-write is needed
+		void changed(uint64_t n = 1) {
+			changes_.store(changes_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		// Allocates everything keys_ holds, so it is declared (and destroyed) around it
+		SlabArena arena_;
+		// Every key of the shard, whatever its type, with its deadline inline
+		Keyspace keys_;
+		// Deadlines of the keys in keys_ that have one, in due order
+		ttl::Index expiry_;
+		EpochDomain* domain_;
+
+		size_t maxmemory_ = 0;
+		Evictor evictor_;
+		std::atomic<size_t> evicted_{ 0 };
+		std::atomic<uint64_t> changes_{ 0 };
+		HashLimits hash_limits_;
+		DropHook on_drop_;
+		bool loading_ = false;
 	};
 
 	class Store {
 	public:
-		explicit Store(size_t n_shards = 1);
-		Shard& shard_for(const std::string& key);
+		explicit Store(size_t n_shards = 1, ttl::Engine expiry = ttl::Engine::Heap, bool shared_reads = false);
+		Shard& shard_for(std::string_view key) { return *shards_[shard_index(key)]; }
 		Shard& shard_by_index(size_t i) { return *shards_[i]; }
+		size_t shard_index(std::string_view key) const;
 		size_t shard_count() const { return shards_.size(); }
-		void sweep_all();
+		// Domain of the shards' shared-read mode; nullptr if they are not in it
+		EpochDomain* shared_reads() const { return domain_.get(); }
+		// Splits a memory limit evenly between the shards (keys are spread evenly too)
+		void set_maxmemory(size_t bytes, EvictPolicy policy);
+		void set_hash_limits(const HashLimits& limits);
+		// Sum of the shards' changes(); callable from any thread
+		uint64_t changes() const;
+		// Shard::on_drop for every shard, told which one dropped the key
+		void on_drop(std::function<void(size_t shard, std::string_view key)> f);
+		void set_loading(bool on);
 
 	private:
+		std::unique_ptr<EpochDomain> domain_;
 		std::vector<std::unique_ptr<Shard>> shards_;
 	};
 
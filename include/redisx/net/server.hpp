@@ -1,18 +1,28 @@
 #pragma once
 #include <asio.hpp>
+#include <vector>
 #include <redisx/core/router.hpp>
-#include <redisx/util/thread_pool.hpp>
 
 namespace redisx {
 
 	class Server {
 	public:
-		Server(asio::io_context& io, uint16_t port, Router& router, ThreadPool& pool);
+		// With reuse_port the listener is bound with SO_REUSEPORT, so one Server per
+		// I/O thread can share the port and the kernel spreads connections over them.
+		Server(asio::io_context& io, uint16_t port, Router& router, bool reuse_port = false);
+
+		// Fallback where SO_REUSEPORT is unavailable: accept each new connection into
+		// the next of these contexts in turn (sessions stay on the context they land on).
+		void spread_over(std::vector<asio::io_context*> ctxs) { targets_ = std::move(ctxs); }
+
+		static bool reuse_port_supported();
+
 	private:
 		void accept();
 		asio::ip::tcp::acceptor acceptor_;
 		Router& router_;
-		ThreadPool& pool_;
+		std::vector<asio::io_context*> targets_;
+		size_t next_ = 0;
 	};
 
 } // namespace redisx
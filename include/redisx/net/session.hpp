@@ -1,35 +1,83 @@
 #pragma once
 #include <asio.hpp>
+#include <cstdint>
 #include <deque>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <redisx/core/router.hpp>
-#include <redisx/util/thread_pool.hpp>
 #include <redisx/proto/resp.hpp>
 
 namespace redisx {
 
 	class Session : public std::enable_shared_from_this<Session> {
 	public:
-		Session(asio::ip::tcp::socket sock, Router& router, ThreadPool& pool);
+		Session(asio::ip::tcp::socket sock, Router& router);
 		void start();
 
 	private:
 		void do_read();
+		// Reads again once a stop for backpressure has drained (see paused_)
+		void resume_read();
+		bool backlogged() const;
 		void do_write();
-		void enqueue_write(std::string msg);
-		void handle_frame(const std::vector<std::string>& args);
+		void enqueue_write(Reply msg);
+		void make_room();
+		void parse_input();
+		bool finish_large_bulk();
+		void protocol_error();
+		void handle_frame(std::vector<std::string_view> args);
+		// Delivers the reply for frame #seq; replies are released to the socket
+		// strictly in frame order, whichever shard finishes first.
+		void complete(std::uint64_t seq, Reply reply);
 
 		asio::ip::tcp::socket socket_;
 		asio::any_io_executor ex_;
 		asio::strand<asio::any_io_executor> strand_;
-		std::vector<char> inbuf_;
-		std::string pending_;
-		std::deque<std::string> outq_;
+
+		// Input is read into chunks and frames are parsed as views into them. Each
+		// frame in flight holds a reference to its chunk, which is handed back to the
+		// strand with the reply, so a chunk is recycled only once every handler using
+		// it has finished. [parsed, filled) is the unparsed tail (a partial frame).
+		struct Chunk {
+			std::vector<char> buf;
+			std::size_t filled = 0;
+			std::size_t parsed = 0;
+		};
+		using ChunkPtr = std::shared_ptr<Chunk>;
+		ChunkPtr in_;
+		std::vector<ChunkPtr> spare_;
+
+		// Incremental parser state for the frame being assembled. Its earlier args
+		// may live in chunks already retired (held_), and a large bulk is read
+		// straight into a dedicated buffer sized from its header (bulk_).
+		RespParser parser_;
+		std::vector<ChunkPtr> held_;
+		ChunkPtr bulk_;
+		std::deque<Reply> outq_;
+		// Gather list for the write in flight, which covers the first writing_
+		// replies of outq_ (each one or more buffers).
+		std::vector<asio::const_buffer> wbufs_;
+		std::size_t writing_ = 0;
+		// Written reply texts, cleared but keeping their capacity; each frame's
+		// reply is built into one of these, so steady-state replies do not allocate.
+		std::vector<std::string> free_bufs_;
+
+		// Pipelining: frames are numbered as parsed (read chain) and completed
+		// on the strand; reorder_[i] holds the reply for frame next_out_ + i.
+		std::uint64_t next_seq_ = 0;
+		std::uint64_t next_out_ = 0;
+		std::deque<std::optional<Reply>> reorder_;
+
+		// Backpressure: while too many frames are in flight or too many reply bytes
+		// wait in outq_, frames are left unparsed and no read is issued (paused_);
+		// complete() and finished writes start reading again once they drain.
+		std::size_t queued_bytes_ = 0;
+		bool paused_ = false;
 
 		Router& router_;
-		ThreadPool& pool_;
 	};
 
 } // namespace redisx
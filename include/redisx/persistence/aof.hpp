@@ -0,0 +1,143 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <redisx/core/store.hpp>
+#include <redisx/util/shard_pool.hpp>
+
+namespace redisx {
+
+	// When the append-only file is flushed to disk (appendfsync).
+	enum class Fsync { Always, EverySec, No };
+
+	// Parses "always", "everysec" or "no"; false if unknown.
+	bool parse_fsync(std::string_view name, Fsync& out);
+
+	// Wall-clock time (Unix ms) of a steady-clock deadline, as PEXPIREAT takes it.
+	long long unix_ms_at(std::chrono::steady_clock::time_point tp);
+
+	// Append-only file: every write command, as RESP, in the order it was applied
+	// to its key. Expiry is logged as absolute PEXPIREAT, so replaying the file
+	// later gives the same deadlines, and a key that expires or is evicted as a DEL
+	// where it went.
+	//
+	// Shard threads append to a buffer of their own; a writer thread takes all of
+	// them at once, writes them with one call each and, with Fsync::Always, syncs
+	// once for the whole batch before releasing the replies that waited on it
+	// (group commit). EverySec syncs at most once a second, No leaves it to the OS.
+	// Commands of one key always go through one buffer, so their order survives
+	// even though buffers are interleaved in the file.
+	//
+	// A rewrite replaces the file with the fewest commands that recreate the store
+	// (see rewrite_in_background), so it grows with the live keys, not the history.
+	class AppendLog {
+	public:
+		AppendLog(Store& store, ShardPool& pool, std::string path, Fsync policy);
+		~AppendLog();       // writes and syncs what is buffered; a running rewrite is abandoned
+		AppendLog(const AppendLog&) = delete;
+		AppendLog& operator=(const AppendLog&) = delete;
+
+		const std::string& path() const { return path_; }
+		Fsync policy() const { return policy_; }
+		bool exists() const;
+
+		// Runs the file's commands against the store before anything is served;
+		// commands counts them. A command cut short at the end, as a crash leaves it,
+		// is cut off the file with a warning; anything else that does not parse fails,
+		// with the reason in error.
+		bool replay(size_t& commands, std::string& error);
+		// Opens the file for appending and starts the writer. A new file starts with
+		// the store's current contents, so that it alone holds the whole dataset.
+		bool open(std::string& error);
+
+		// From shard's thread: logs one command.
+		void append(size_t shard, std::span<const std::string_view> args);
+		// Commands shard has appended so far; from shard's thread.
+		uint64_t appended(size_t shard) const { return buffers_[shard]->appended; }
+		// From shard's thread, with Fsync::Always: runs f on the writer thread once
+		// everything shard has appended so far is on disk.
+		void when_durable(size_t shard, std::function<void()> f);
+
+		// BGREWRITEAOF: parks every shard thread, forks, and lets them go; the child
+		// writes the store's contents as commands to path.tmp while the shards keep
+		// a copy of what they append from then on. Once the child is done, the
+		// writer adds that copy, syncs, and renames the file over path, logging to it
+		// from there on. Without fork each shard writes out its keys on its own
+		// thread instead. False, with the reason in error, if a rewrite is running
+		// or the fork failed.
+		bool rewrite_in_background(std::string& error);
+		// auto-aof-rewrite-percentage/-min-size: the writer starts a rewrite once
+		// the file is at least min_bytes and percent larger than after the last one
+		// (or at startup); 0 percent turns it off. Set before open().
+		void set_auto_rewrite(unsigned percent, uint64_t min_bytes) {
+			auto_percent_ = percent;
+			auto_min_bytes_ = min_bytes;
+		}
+
+		// For INFO's persistence section
+		struct Status {
+			bool rewriting = false;
+			bool last_rewrite_ok = true;
+			long long last_rewrite_seconds = -1;
+			long long current_rewrite_seconds = -1;
+			uint64_t current_size = 0;
+			uint64_t base_size = 0;         // the size after the last rewrite, or at startup
+		};
+		Status status() const;
+
+	private:
+		struct Buffer {
+			std::mutex mu;
+			std::string data;
+			std::vector<std::function<void()>> waiting;
+			uint64_t appended = 0;      // only the shard's thread touches this
+			bool rewriting = false;     // while set, appends are copied to since_rewrite
+			std::string since_rewrite;
+		};
+
+		void run();
+		void wake();
+		std::string rewrite_path() const { return path_ + ".tmp"; }
+		// From the rewrite's own thread, once the new file's base is written (or not)
+		void rewritten(bool ok);
+		// On the writer thread: completes the new file with tails, what the shards
+		// appended since the rewrite began, and logs to it from now on
+		bool install_rewrite(std::vector<std::string>& tails);
+
+		Store& store_;
+		ShardPool& pool_;
+		std::string path_;
+		Fsync policy_;
+		int fd_ = -1;
+		std::vector<std::unique_ptr<Buffer>> buffers_;
+
+		std::mutex mu_;                 // guards pending_, stop_ and rewrite_*_
+		std::condition_variable cv_;
+		bool pending_ = false;
+		bool stop_ = false;
+		bool rewrite_done_ = false;     // the base is written, or failed: rewrite_ok_
+		bool rewrite_ok_ = false;
+		std::thread writer_;
+
+		unsigned auto_percent_ = 100;
+		uint64_t auto_min_bytes_ = 64ull << 20;
+		std::atomic<uint64_t> size_{ 0 };
+		std::atomic<uint64_t> base_size_{ 0 };
+		std::atomic<bool> rewriting_{ false };
+		std::atomic<bool> last_rewrite_ok_{ true };
+		std::atomic<long long> last_rewrite_ms_{ -1 };
+		std::atomic<long long> rewrite_started_ms_{ 0 };  // steady clock; 0 if none is running
+		std::atomic<long long> child_{ -1 };            // the forked rewrite's pid
+		std::thread rewriter_;                          // waits for (or, without fork, runs) the rewrite
+	};
+
+} // namespace redisx
@@ -1,12 +1,90 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <thread>
+#include <redisx/core/store.hpp>
+#include <redisx/util/shard_pool.hpp>
 
 namespace redisx {
 
+	// Point-in-time dump of a Store to one file, and loading it back at startup.
+	//
+	// Layout; integers are little-endian, varints LEB128:
+	//   header   "RDXSNAP\0", version u32, shard count u32, save time u64 (Unix ms)
+	//   section  one per shard: 'S', shard u32, keys u64, payload bytes u64, payload,
+	//            CRC-32C of the payload u32
+	//   trailer  'E', section count u32
+	// A payload is one record per key: type u8 (0 string, 1 hash), TTL varint (0 if
+	// none, else the ms left at save time + 1), the key, then the string, or a field
+	// count and the fields and values; every string is a varint length and its bytes.
+	// Keys go back to whichever shard owns them, so the shard count may change.
 	class Snapshot {
 	public:
-		bool save(const std::string&) { return true; }
-		bool load(const std::string&) { return true; }
+		static constexpr std::uint32_t kVersion = 1;
+
+		Snapshot(Store& store, ShardPool& pool, std::string path)
+			: store_(store), pool_(pool), path_(std::move(path)) {}
+		~Snapshot();        // waits for a background save to finish
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+
+		const std::string& path() const { return path_; }
+
+		// SAVE: the shards copy out their records on their own threads, as many at
+		// once as there are cores, and the sections are written to one file a chunk
+		// at a time as they come (as path.tmp, synced, then renamed over path).
+		// Blocks the caller, which must not be a shard's thread. False, with the
+		// reason in error, if writing failed or another save is running.
+		bool save(std::string& error);
+		// BGSAVE: on Linux and other POSIX systems, parks every shard thread between
+		// commands, forks, and lets them go again: the child writes the file from its
+		// copy-on-write image of that instant and exits, while the parent serves on
+		// and reaps it on a thread of its own. Elsewhere the same as save() on a
+		// thread of its own. False, with the reason in error, if a save is running
+		// or the fork failed.
+		bool save_in_background(std::string& error);
+		bool saving() const { return busy_.load(); }
+		// Unix time (s) of the last successful save; 0 if there has been none
+		long long last_save() const { return last_save_.load(); }
+
+		// For INFO's persistence section
+		struct Status {
+			bool background_saving = false;
+			long long last_save = 0;
+			uint64_t changes_since_save = 0;    // store changes since the last successful save began
+			bool last_background_ok = true;
+			long long last_background_seconds = -1;
+			long long current_background_seconds = -1;
+			size_t last_cow_bytes = 0;          // memory the last forked save's child had to copy
+		};
+		Status status() const;
+
+		// Fills the store from path before it serves anything: the file is mapped,
+		// its sections checked in parallel, and every shard thread restores its own
+		// keys. keys counts what was loaded. No file means nothing to load; a
+		// damaged one fails, with the reason in error.
+		bool load(size_t& keys, std::string& error);
+
+	private:
+		// Writes the file. Forked, the shard threads are gone and the child encodes
+		// the shards one after another on its only thread.
+		bool write(std::string& error, bool forked = false);
+		// Bookkeeping after a successful save that began at changes
+		void saved(uint64_t changes);
+		void background_done(bool ok, uint64_t changes, size_t cow_bytes);
+
+		Store& store_;
+		ShardPool& pool_;
+		std::string path_;
+		std::atomic<bool> busy_{ false };
+		std::atomic<long long> last_save_{ 0 };
+		std::atomic<uint64_t> saved_changes_{ 0 };
+		std::atomic<bool> last_bg_ok_{ true };
+		std::atomic<long long> last_bg_ms_{ -1 };
+		std::atomic<long long> bg_started_ms_{ 0 };     // steady clock; 0 if none is running
+		std::atomic<size_t> last_cow_{ 0 };
+		std::thread worker_;                            // runs or reaps the background save
 	};
 
 } // namespace redisx
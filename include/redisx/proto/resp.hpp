@@ -1,8 +1,11 @@
 #pragma once
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
 #include <cstddef>
+#include <limits>
 
 namespace redisx {
 
@@ -22,10 +25,121 @@ namespace redisx {
 	// If protocol error, returns {arr=nullopt, error="...", consumed=bytes_to_drop_or_0}.
 	RespParseResult parse_resp(const char* data, std::size_t len);
 
-	// Emit helpers
-	std::string resp_simple(const std::string& s);  // +OK\r\n
-	std::string resp_error(const std::string& s);   // -ERR msg\r\n
-	std::string resp_bulk(const std::string& s);    // $len\r\n...\r\n
+	// Zero-copy mode: same contract as parse_resp, but args are views into
+	// [data, data+len) and are only valid while that buffer is.
+	struct RespViewParseResult {
+		std::optional<std::vector<std::string_view>> args;
+		std::string error;
+		std::size_t consumed = 0;
+	};
+	RespViewParseResult parse_resp_views(const char* data, std::size_t len);
+
+	// Incremental RESP2 array parser. Its position inside the current frame
+	// (args still expected, current bulk length) survives between feeds, so bytes
+	// that were already accepted are never rescanned when more input arrives.
+	//
+	// feed() consumes whole header lines and whole bulks only; a partial line or
+	// bulk at the end of the input is left unconsumed and must be passed again,
+	// followed by the new bytes. Args are views into the fed buffers, which must
+	// stay valid until the frame has been taken.
+	//
+	// Bulks of at least large_bulk bytes are not buffered by the parser: feed()
+	// stops with LargeBulk once the length is known, so the caller can read the
+	// body (bulk_len() bytes plus CRLF) straight into storage of its own and hand
+	// it back through finish_bulk().
+	class RespParser {
+	public:
+		enum class Status { NeedMore, Frame, LargeBulk, Error };
+
+		explicit RespParser(std::size_t large_bulk = std::numeric_limits<std::size_t>::max())
+			: large_bulk_(large_bulk) {}
+
+		Status feed(const char* data, std::size_t len, std::size_t& consumed);
+		Status finish_bulk(std::string_view body_crlf);
+
+		// Valid after Frame: moves the args out and readies the parser for the next frame.
+		std::vector<std::string_view> take_args();
+		// True while a frame has been started but not completed.
+		bool in_frame() const { return state_ != State::ArrayHeader; }
+		std::size_t bulk_len() const { return bulk_len_; }
+		const std::string& error() const { return error_; }
+		void reset();
+
+	private:
+		enum class State { ArrayHeader, BulkHeader, BulkBody, BulkExternal };
+		Status fail(const char* msg);
+
+		State state_ = State::ArrayHeader;
+		long long remaining_ = 0;       // args still expected in the current frame
+		std::size_t bulk_len_ = 0;      // length of the bulk being read
+		std::size_t large_bulk_;
+		std::vector<std::string_view> args_;
+		std::string error_;
+	};
+
+	// Pre-encoded replies for the constants most commands answer with.
+	namespace reply {
+		inline constexpr std::string_view ok = "+OK\r\n";
+		inline constexpr std::string_view pong = "+PONG\r\n";
+		inline constexpr std::string_view nil = "$-1\r\n";
+		inline constexpr std::string_view zero = ":0\r\n";
+		inline constexpr std::string_view one = ":1\r\n";
+		inline constexpr std::string_view wrongtype = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+		inline constexpr std::string_view oom = "-OOM command not allowed when used memory > 'maxmemory'.\r\n";
+	}
+
+	// Immutable bytes shared by reference, e.g. a large stored value and the
+	// replies still being written that send it.
+	using SharedBytes = std::shared_ptr<const std::string>;
+
+	// A reply on its way to the socket: the encoded text, with shared payloads that
+	// are sent in place at recorded offsets instead of being copied into it.
+	struct Reply {
+		struct Splice {
+			std::size_t at;         // offset into text, ascending
+			SharedBytes bytes;
+		};
+		std::string text;
+		std::vector<Splice> splices;
+	};
+
+	// Appends replies straight into an output buffer (normally a recycled session
+	// buffer, so nothing is allocated once its capacity has grown). Integers and
+	// lengths are formatted with to_chars; constants are copied from `reply`.
+	// Writing into a Reply, shared bulks are spliced in rather than copied.
+	class RespWriter {
+	public:
+		explicit RespWriter(std::string& out) : out_(out) {}
+		explicit RespWriter(Reply& out) : out_(out.text), splices_(&out.splices) {}
+
+		void raw(std::string_view s) { out_.append(s); }
+		void ok() { raw(reply::ok); }
+		void nil() { raw(reply::nil); }
+		void simple(std::string_view s);            // +s\r\n
+		void error(std::string_view msg);           // -ERR msg\r\n
+		void bulk(std::string_view s);              // $len\r\n...\r\n
+		void bulk(const SharedBytes& s);            // same, by reference when writing a Reply
+		void integer(long long v);                  // :n\r\n
+		void array(std::size_t n);                  // *n\r\n, elements follow
+
+		void append(Reply&& r);                     // another reply's bytes, splices included
+
+		// Rolls back to a size() taken earlier, dropping whatever was written since.
+		std::size_t size() const { return out_.size(); }
+		void rewind(std::size_t mark);
+
+		std::string& buffer() { return out_; }
+
+	private:
+		void header(char type, long long n);
+		std::string& out_;
+		std::vector<Reply::Splice>* splices_ = nullptr;
+	};
+
+	// Emit helpers (allocate a fresh string; prefer RespWriter on hot paths)
+	std::string resp_simple(std::string_view s);    // +OK\r\n
+	std::string resp_error(std::string_view s);     // -ERR msg\r\n
+	std::string resp_bulk(std::string_view s);      // $len\r\n...\r\n
 	std::string resp_nil();                         // $-1\r\n
 	std::string resp_int(long long v);              // :n\r\n
 
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 
 namespace redisx::ttl {
 
@@ -19,6 +20,26 @@ namespace redisx::ttl {
     // Now (monotonic)
     inline TimePt now() { return Clock::now(); }
 
+    // Cached now for the hot path: the last time published by a CoarseTicker, at most
+    // about one tick behind, read with a single atomic load. Falls back to now() while
+    // no ticker runs. Good for expiry checks and second-granularity deadlines; use
+    // now() for millisecond deadlines (PX, PEXPIRE) so they don't fire early.
+    TimePt coarse_now();
+
+    // Publishes now() for coarse_now() every `tick` from a background thread for as
+    // long as it lives. One per process.
+    class CoarseTicker {
+    public:
+        explicit CoarseTicker(Ms tick = Ms(1));
+        ~CoarseTicker();
+        CoarseTicker(const CoarseTicker&) = delete;
+        CoarseTicker& operator=(const CoarseTicker&) = delete;
+
+    private:
+        struct State;
+        State* state_;
+    };
+
     // Build absolute expiries from relative durations
     inline TimePt from_seconds(long long sec, TimePt base = now()) {
         if (sec < 0) sec = 0;
@@ -41,9 +62,14 @@ namespace redisx::ttl {
 
     // ---- Per-shard expiry index (PIMPL; single-threaded owner) -----------------
 
+    // How an Index orders deadlines:
+    //  Heap  - binary min-heap; exact, O(log n) set, cancelled nodes dropped lazily
+    //  Wheel - hierarchical timing wheel at 1 ms resolution; O(1) set and clear
+    enum class Engine { Heap, Wheel };
+
     class Index {
     public:
-        Index();
+        explicit Index(Engine engine = Engine::Heap);
         ~Index();
         Index(const Index&) = delete;
         Index& operator=(const Index&) = delete;
@@ -51,24 +77,26 @@ namespace redisx::ttl {
         Index& operator=(Index&&) noexcept;
 
         // record/update expiry for key
-        void set(const std::string& key, TimePt when);
+        void set(std::string_view key, TimePt when);
 
-        // remove expiry tracking for key (persist)
-        void clear(const std::string& key);
+        // remove expiry tracking for key (persist, delete)
+        void clear(std::string_view key);
 
-        // Pop all due entries (<= now) and call on_expire(key).
-        // The callback should erase the key if it is indeed expired.
+        // number of keys with a deadline
+        size_t size() const;
+
+        // Pop due entries (<= now), at most `limit` of them, and call on_expire(key);
+        // popped keys are no longer tracked. The callback should erase the key if it
+        // is indeed expired. Returns how many were popped.
         template <class Fn>
-        void sweep_due(TimePt at, Fn&& on_expire) {
-            while (true) {
-                std::string key;
-                bool have_due = false;
-                bool valid = false;
-                pop_due_internal(at, have_due, valid, key);
-                if (!have_due) break;   // nothing due right now
-                if (!valid) continue;   // consumed stale node; keep looping
+        size_t sweep_due(TimePt at, Fn&& on_expire, size_t limit = SIZE_MAX) {
+            std::string key;
+            size_t n = 0;
+            while (n < limit && pop_due(at, key)) {
                 on_expire(key);         // shard decides final erase after checking actual expire_at
+                ++n;
             }
+            return n;
         }
 
         // Next wake-up time if any key is scheduled; std::nullopt if empty
@@ -78,17 +106,13 @@ namespace redisx::ttl {
         void prune();
 
     private:
-        struct Impl;           // opaque implementation
+        struct Impl;           // opaque implementation, one per Engine
+        struct Heap;
+        struct Wheel;
         Impl* impl_{ nullptr };
 
-        // Examine heap top, drop stales, and indicate if a due/current node exists.
-        // If a current & due node exists, it is popped and (have_due=true, valid=true, out_key set).
-        // If we only popped stale nodes, (have_due=true, valid=false) to let caller loop again.
-        void pop_due_internal(TimePt now,
-            bool& have_due,
-            bool& valid,
-            std::string& out_key);
+        // Pops one key whose deadline is <= now into out_key; false once none is due.
+        bool pop_due(TimePt now, std::string& out_key);
     };
 
 } // namespace redisx::ttl
-
@@ -0,0 +1,65 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace redisx {
+
+    // Hands chunks of bytes from one producing thread to one consuming thread, in
+    // order. At most capacity chunks wait at a time: the producer blocks until the
+    // consumer takes one, so what is in flight stays bounded however far ahead the
+    // producer gets.
+    class ChunkQueue {
+    public:
+        explicit ChunkQueue(size_t capacity = 4) : capacity_(capacity == 0 ? 1 : capacity) {}
+        ChunkQueue(const ChunkQueue&) = delete;
+        ChunkQueue& operator=(const ChunkQueue&) = delete;
+
+        // Producer: queues chunk, leaving it empty; dropped once abandoned.
+        void push(std::string& chunk) {
+            std::unique_lock<std::mutex> lk(m_);
+            cv_.wait(lk, [&] { return abandoned_ || q_.size() < capacity_; });
+            if (!abandoned_) q_.push_back(std::move(chunk));
+            chunk.clear();
+            cv_.notify_all();
+        }
+        // Producer: there is nothing more.
+        void close() {
+            std::lock_guard<std::mutex> lk(m_);
+            closed_ = true;
+            cv_.notify_all();
+        }
+
+        // Consumer: the next chunk, waiting for it; false once the producer has
+        // closed the queue and every chunk was taken.
+        bool pop(std::string& out) {
+            std::unique_lock<std::mutex> lk(m_);
+            cv_.wait(lk, [&] { return closed_ || !q_.empty(); });
+            if (q_.empty()) return false;
+            out = std::move(q_.front());
+            q_.pop_front();
+            cv_.notify_all();
+            return true;
+        }
+        // Consumer: wants no more. Queued chunks are dropped and the producer no
+        // longer waits; pop still tells when it is done.
+        void abandon() {
+            std::lock_guard<std::mutex> lk(m_);
+            abandoned_ = true;
+            q_.clear();
+            cv_.notify_all();
+        }
+
+    private:
+        std::mutex m_;
+        std::condition_variable cv_;
+        std::deque<std::string> q_;
+        size_t capacity_;
+        bool closed_ = false;
+        bool abandoned_ = false;
+    };
+
+} // namespace redisx
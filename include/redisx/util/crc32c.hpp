@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace redisx {
+
+    // CRC-32C (Castagnoli), as used by iSCSI and ext4. Pass the previous result
+    // as crc to continue a checksum over more data; start from 0.
+    std::uint32_t crc32c(std::uint32_t crc, const void* data, size_t n);
+
+} // namespace redisx
@@ -0,0 +1,134 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace redisx {
+
+    // Epoch-based reclamation for structures that many threads read without locks
+    // while one thread per structure writes. A reader pins the current epoch for the
+    // length of a read; a writer unlinks an object, retires it tagged with the epoch
+    // at that moment, and frees it once every pinned reader is past that epoch.
+    class EpochDomain {
+    public:
+        static constexpr size_t kMaxReaders = 128;
+        static constexpr std::uint64_t kIdle = UINT64_MAX;
+
+        // Registers the calling thread as a reader on first use; false once all
+        // kMaxReaders slots are taken, in which case the thread must not pin.
+        bool reader_ready() {
+            const size_t id = thread_id();
+            if (id >= kMaxReaders) return false;
+            size_t n = readers_.load();
+            while (n <= id && !readers_.compare_exchange_weak(n, id + 1)) {}
+            return true;
+        }
+
+        // Pins the epoch for as long as it lives; reader_ready() must have returned true.
+        class Guard {
+        public:
+            explicit Guard(EpochDomain& d) : slot_(d.slots_[thread_id()].epoch) {
+                std::uint64_t e = d.global_.load();
+                for (;;) {
+                    slot_.store(e);
+                    std::uint64_t again = d.global_.load();
+                    if (again == e) break;
+                    e = again;
+                }
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+            ~Guard() { slot_.store(kIdle, std::memory_order_release); }
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+
+        private:
+            std::atomic<std::uint64_t>& slot_;
+        };
+
+        // Writer side: the tag for an object unlinked just before this call.
+        std::uint64_t retire_tag() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return global_.load();
+        }
+
+        // Writer side: moves the epoch on and returns the oldest epoch still pinned
+        // (kIdle if none); objects tagged below it can be freed.
+        std::uint64_t advance() {
+            global_.fetch_add(1);
+            std::uint64_t oldest = kIdle;
+            const size_t n = readers_.load();
+            for (size_t i = 0; i < n; ++i) {
+                std::uint64_t e = slots_[i].epoch.load();
+                if (e < oldest) oldest = e;
+            }
+            return oldest;
+        }
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<std::uint64_t> epoch{ kIdle };
+        };
+
+        // process-wide, so a thread has the same slot in every domain
+        static size_t thread_id() {
+            static std::atomic<size_t> next{ 0 };
+            thread_local const size_t id = next.fetch_add(1);
+            return id;
+        }
+
+        alignas(64) std::atomic<std::uint64_t> global_{ 1 };
+        alignas(64) std::atomic<size_t> readers_{ 0 };
+        Slot slots_[kMaxReaders];
+    };
+
+    // Objects one writer has unlinked but readers may still hold. Single-threaded.
+    class RetireList {
+    public:
+        explicit RetireList(EpochDomain& d) : domain_(d) {}
+        ~RetireList() {
+            for (auto& r : pending_) r.destroy(r.p, r.ctx);
+        }
+        RetireList(const RetireList&) = delete;
+        RetireList& operator=(const RetireList&) = delete;
+
+        template <class T>
+        void retire(T* p) {
+            retire(p, [](void* q, void*) { delete static_cast<T*>(q); }, nullptr);
+        }
+
+        // As above, but p is freed by destroy(p, ctx) rather than delete.
+        void retire(void* p, void (*destroy)(void*, void*), void* ctx) {
+            pending_.push_back({ domain_.retire_tag(), p, ctx, destroy });
+            if (pending_.size() >= next_reclaim_) reclaim();
+        }
+
+        // Frees whatever no reader can still see.
+        void reclaim() {
+            if (pending_.empty()) return;
+            const std::uint64_t oldest = domain_.advance();
+            size_t kept = 0;
+            for (auto& r : pending_) {
+                if (r.tag < oldest) r.destroy(r.p, r.ctx);
+                else pending_[kept++] = r;
+            }
+            pending_.resize(kept);
+            next_reclaim_ = std::max(kBatch, 2 * kept);   // amortised while readers hold on
+        }
+
+    private:
+        static constexpr size_t kBatch = 64;
+
+        struct Retired {
+            std::uint64_t tag;
+            void* p;
+            void* ctx;
+            void (*destroy)(void*, void*);
+        };
+
+        EpochDomain& domain_;
+        std::vector<Retired> pending_;
+        size_t next_reclaim_ = kBatch;
+    };
+
+} // namespace redisx
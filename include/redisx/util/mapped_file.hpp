@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace redisx {
+
+    // A file, read-only. Mapped where possible, so the kernel reads it ahead into
+    // the page cache and no record costs a system call; elsewhere read whole.
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+#ifdef _WIN32
+        bool open(const std::string& path) {
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            if (!in) return false;
+            buf_.resize(static_cast<size_t>(in.tellg()));
+            in.seekg(0);
+            if (!in.read(buf_.data(), static_cast<std::streamsize>(buf_.size()))) return false;
+            data_ = buf_.data();
+            size_ = buf_.size();
+            return true;
+        }
+#else
+        ~MappedFile() {
+            if (map_) ::munmap(map_, size_);
+        }
+        bool open(const std::string& path) {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ != 0) {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    return false;
+                }
+                map_ = p;
+                data_ = static_cast<const char*>(p);
+                // read far ahead and drop pages behind: files are read front to back
+                ::madvise(map_, size_, MADV_SEQUENTIAL);
+                ::madvise(map_, size_, MADV_WILLNEED);
+            }
+            ::close(fd);
+            return true;
+        }
+#endif
+        const char* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        std::string buf_;
+#else
+        void* map_ = nullptr;
+#endif
+    };
+
+} // namespace redisx
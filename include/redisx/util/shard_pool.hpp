@@ -0,0 +1,86 @@
+#pragma once
+#include <asio.hpp>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace redisx {
+
+    // One single-threaded executor per shard. Everything posted to index i runs on
+    // the same thread in FIFO order, so shard i's data is never touched concurrently
+    // and needs no locking.
+    class ShardPool {
+    public:
+        explicit ShardPool(size_t n) {
+            if (n == 0) n = 1;
+            ctxs_.reserve(n);
+            guards_.reserve(n);
+            threads_.reserve(n);
+            for (size_t i = 0; i < n; ++i) {
+                // concurrency hint 1: each context is only ever run by its own thread
+                ctxs_.push_back(std::make_unique<asio::io_context>(1));
+                guards_.push_back(asio::make_work_guard(*ctxs_.back()));
+            }
+            for (auto& c : ctxs_) {
+                threads_.emplace_back([ctx = c.get()] { ctx->run(); });
+            }
+        }
+        ~ShardPool() {
+            for (auto& c : ctxs_) c->stop();
+            for (auto& t : threads_) t.join();
+        }
+        ShardPool(const ShardPool&) = delete;
+        ShardPool& operator=(const ShardPool&) = delete;
+
+        size_t size() const { return ctxs_.size(); }
+        asio::io_context& context(size_t i) { return *ctxs_[i]; }
+
+        template<class F>
+        void post(size_t i, F&& f) {
+            asio::post(*ctxs_[i], std::forward<F>(f));
+        }
+
+        // Runs f on the calling thread, which must not be a shard's, while every
+        // shard thread waits between two tasks (to fork with all of them at rest).
+        // Callers take turns: two parking at once could each hold some shards.
+        template<class F>
+        void with_all_parked(F&& f) {
+            std::lock_guard<std::mutex> lk(park_mu_);
+            std::vector<std::promise<void>> parked(size());
+            std::promise<void> resume;
+            std::shared_future<void> resumed = resume.get_future().share();
+            for (size_t i = 0; i < size(); ++i) {
+                post(i, [&parked, i, resumed] {
+                    parked[i].set_value();
+                    resumed.wait();
+                });
+            }
+            for (auto& p : parked) p.get_future().wait();
+            struct Resume {
+                std::promise<void>& p;
+                ~Resume() { p.set_value(); }
+            } let_go{ resume };
+            f();
+        }
+
+        // Runs f on the calling thread while no with_all_parked can start: for work
+        // that keeps shard threads waiting on the caller, who would otherwise wait
+        // on a shard thread held up behind a park.
+        template<class F>
+        void without_parking(F&& f) {
+            std::lock_guard<std::mutex> lk(park_mu_);
+            f();
+        }
+
+    private:
+        using Guard = asio::executor_work_guard<asio::io_context::executor_type>;
+        std::vector<std::unique_ptr<asio::io_context>> ctxs_;
+        std::vector<Guard> guards_;
+        std::vector<std::thread> threads_;
+        std::mutex park_mu_;
+    };
+
+} // namespace redisx
@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace redisx {
+
+    // Size-class allocator for the data of one shard. Blocks of up to kMaxSmall
+    // bytes are served from per-class free lists, refilled by carving 64 KB slabs;
+    // larger blocks go to the global heap. Slabs are kept for reuse until the arena
+    // is destroyed. Single-threaded, like the shard owning it.
+    //
+    // Every byte handed out is counted; the counters may be read from any thread.
+    class SlabArena {
+    public:
+        static constexpr size_t kSlabSize = 64 * 1024;
+        static constexpr size_t kMaxSmall = 1024;
+        static constexpr size_t kAlign = 16;
+
+        struct Stats {
+            size_t used = 0;        // bytes in live blocks, small ones rounded up to their class
+            size_t slabs = 0;       // bytes reserved in slabs for small blocks
+            size_t large = 0;       // bytes in live large blocks
+            size_t blocks = 0;      // live blocks, small and large
+            size_t external = 0;    // see charge()
+        };
+
+        SlabArena() = default;
+        ~SlabArena();
+        SlabArena(const SlabArena&) = delete;
+        SlabArena& operator=(const SlabArena&) = delete;
+
+        void* allocate(size_t n);
+        void deallocate(void* p, size_t n) noexcept;
+        Stats stats() const;
+
+        // Counter for memory that lives outside the arena but is charged to it, such
+        // as a value shared with replies still being written. It may be updated from
+        // any thread and outlive the arena.
+        using Charge = std::shared_ptr<std::atomic<size_t>>;
+        const Charge& charge() const { return external_; }
+
+    private:
+        static constexpr size_t kClasses = 20;      // 16..128 by 16, then 4 per doubling to 1024
+        static size_t class_of(size_t n);
+        static size_t class_size(size_t c);
+        void* refill(size_t c);
+
+        // single writer: a plain load and store, no read-modify-write
+        static void add(std::atomic<size_t>& c, size_t d) { c.store(c.load(std::memory_order_relaxed) + d, std::memory_order_relaxed); }
+        static void sub(std::atomic<size_t>& c, size_t d) { c.store(c.load(std::memory_order_relaxed) - d, std::memory_order_relaxed); }
+
+        struct FreeBlock { FreeBlock* next; };
+        struct Class {
+            FreeBlock* free = nullptr;
+            char* next = nullptr;       // unused tail of the class's newest slab
+            char* end = nullptr;
+        };
+        Class classes_[kClasses];
+        std::vector<void*> slabs_;
+
+        std::atomic<size_t> used_{ 0 };
+        std::atomic<size_t> slab_bytes_{ 0 };
+        std::atomic<size_t> large_{ 0 };
+        std::atomic<size_t> blocks_{ 0 };
+        Charge external_ = std::make_shared<std::atomic<size_t>>(0);
+    };
+
+    // Standard allocator over a SlabArena, for containers holding shard data.
+    template <class T>
+    class SlabAllocator {
+    public:
+        using value_type = T;
+        static_assert(alignof(T) <= SlabArena::kAlign);
+
+        explicit SlabAllocator(SlabArena& a) noexcept : arena_(&a) {}
+        template <class U>
+        SlabAllocator(const SlabAllocator<U>& o) noexcept : arena_(&o.arena()) {}
+
+        T* allocate(size_t n) {
+            if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+            return static_cast<T*>(arena_->allocate(n * sizeof(T)));
+        }
+        void deallocate(T* p, size_t n) noexcept { arena_->deallocate(p, n * sizeof(T)); }
+
+        SlabArena& arena() const { return *arena_; }
+
+        template <class U>
+        bool operator==(const SlabAllocator<U>& o) const noexcept { return arena_ == &o.arena(); }
+
+    private:
+        SlabArena* arena_;
+    };
+
+    // new/delete for single objects in an arena
+    template <class T, class... A>
+    T* slab_new(SlabArena& a, A&&... args) {
+        void* p = a.allocate(sizeof(T));
+        try {
+            if constexpr (std::is_aggregate_v<T>) return new (p) T{ std::forward<A>(args)... };
+            else return new (p) T(std::forward<A>(args)...);
+        }
+        catch (...) {
+            a.deallocate(p, sizeof(T));
+            throw;
+        }
+    }
+
+    template <class T>
+    void slab_delete(SlabArena& a, T* p) noexcept {
+        p->~T();
+        a.deallocate(p, sizeof(T));
+    }
+
+    template <class T>
+    struct SlabDelete {
+        SlabArena* arena = nullptr;
+        void operator()(T* p) const noexcept { slab_delete(*arena, p); }
+    };
+    template <class T>
+    using SlabPtr = std::unique_ptr<T, SlabDelete<T>>;
+
+    // Arrays of trivial elements (left uninitialised)
+    template <class T>
+    struct SlabArrayDelete {
+        SlabArena* arena = nullptr;
+        size_t n = 0;
+        void operator()(T* p) const noexcept { arena->deallocate(p, n * sizeof(T)); }
+    };
+    template <class T>
+    using SlabArray = std::unique_ptr<T[], SlabArrayDelete<T>>;
+
+    template <class T>
+    SlabArray<T> slab_array(SlabArena& a, size_t n) {
+        static_assert(std::is_trivial_v<T>);
+        return SlabArray<T>(SlabAllocator<T>(a).allocate(n), { &a, n });
+    }
+
+} // namespace redisx
@@ -0,0 +1,116 @@
+#include <redisx/core/evict.hpp>
+#include <algorithm>
+
+namespace redisx {
+
+    bool parse_evict_policy(std::string_view name, EvictPolicy& out) {
+        struct Named { std::string_view name; EvictPolicy policy; };
+        static constexpr Named kPolicies[] = {
+            { "noeviction",   EvictPolicy::NoEviction },
+            { "allkeys-lru",  EvictPolicy::AllKeysLru },
+            { "allkeys-lfu",  EvictPolicy::AllKeysLfu },
+            { "volatile-lru", EvictPolicy::VolatileLru },
+            { "volatile-ttl", EvictPolicy::VolatileTtl },
+        };
+        for (auto& p : kPolicies) {
+            if (p.name == name) { out = p.policy; return true; }
+        }
+        return false;
+    }
+
+    static uint64_t xorshift(uint64_t& s) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s;
+    }
+
+    // LFU parameters as in Redis' defaults (lfu-log-factor 10, lfu-decay-time 1)
+    static constexpr uint32_t kLfuInit = 5;
+    static constexpr uint32_t kLfuLogFactor = 10;
+
+    static uint32_t seconds(Evictor::TimePoint t) {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count());
+    }
+
+    static uint32_t minutes(Evictor::TimePoint t) {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::minutes>(t.time_since_epoch()).count()) & 0xFFFFFF;
+    }
+
+    // The counter of a, less one per minute since its last access
+    static uint32_t lfu_decayed(uint32_t a, Evictor::TimePoint now) {
+        const uint32_t idle = (minutes(now) - (a >> 8)) & 0xFFFFFF;
+        const uint32_t counter = a & 0xFF;
+        return idle >= counter ? 0 : counter - idle;
+    }
+
+    uint32_t Evictor::initial(TimePoint now) const {
+        if (policy_ == EvictPolicy::AllKeysLfu) return minutes(now) << 8 | kLfuInit;
+        return seconds(now);
+    }
+
+    uint32_t Evictor::touched(uint32_t a, TimePoint now) const {
+        if (policy_ != EvictPolicy::AllKeysLfu) return seconds(now);
+        // readers in shared-read mode touch keys too, so the coin is per thread
+        thread_local uint64_t coin = 0x2545F4914F6CDD1DULL ^ reinterpret_cast<uintptr_t>(&coin);
+        uint32_t counter = lfu_decayed(a, now);
+        if (counter < 255) {
+            // logarithmic: the n-th increment lands with probability 1 / ((n - init) * factor + 1)
+            const uint32_t base = counter > kLfuInit ? counter - kLfuInit : 0;
+            const double p = 1.0 / (base * kLfuLogFactor + 1);
+            if (static_cast<double>(xorshift(coin) >> 11) * 0x1p-53 < p) ++counter;
+        }
+        return minutes(now) << 8 | counter;
+    }
+
+    bool Evictor::eligible(const Entry& e) const {
+        if (policy_ == EvictPolicy::VolatileLru || policy_ == EvictPolicy::VolatileTtl) return e.has_expiry();
+        return true;
+    }
+
+    uint64_t Evictor::score(const Entry& e, TimePoint now) const {
+        switch (policy_) {
+        case EvictPolicy::AllKeysLfu:
+            return 255 - lfu_decayed(e.load_access(), now);
+        case EvictPolicy::VolatileTtl:
+            // soonest deadline first
+            return UINT64_MAX - static_cast<uint64_t>(e.expires.time_since_epoch().count());
+        default:
+            return static_cast<uint32_t>(seconds(now) - e.load_access());     // idle seconds
+        }
+    }
+
+    // Adds up to kSamples eligible keys, from consecutive slots at a random spot,
+    // to the pool; the lowest scores drop out once it is full.
+    void Evictor::populate(const Keyspace& keys, TimePoint now) {
+        size_t sampled = 0;
+        keys.scan_from(static_cast<size_t>(xorshift(rng_)), kMaxScan, [&](const Entry& e) {
+            if (!eligible(e)) return true;
+            const uint64_t s = score(e, now);
+            if (pool_.size() == kPoolSize && s <= pool_.front().score) return ++sampled < kSamples;
+            auto same = std::find_if(pool_.begin(), pool_.end(), [&](const Candidate& c) { return c.key == std::string_view(e.key); });
+            if (same != pool_.end()) pool_.erase(same);
+            else if (pool_.size() == kPoolSize) pool_.erase(pool_.begin());
+            auto at = std::upper_bound(pool_.begin(), pool_.end(), s, [](uint64_t v, const Candidate& c) { return v < c.score; });
+            pool_.insert(at, Candidate{ s, std::string(e.key) });
+            return ++sampled < kSamples;
+            });
+    }
+
+    Entry* Evictor::next_victim(const Keyspace& keys, TimePoint now) {
+        if (policy_ == EvictPolicy::NoEviction) return nullptr;
+        constexpr int kRounds = 4;      // sparse TTL keys may take a few spots to find
+        for (int round = 0; round < kRounds && keys.size() != 0; ++round) {
+            populate(keys, now);
+            while (!pool_.empty()) {
+                // candidates may be stale: gone, or no longer eligible
+                Candidate c = std::move(pool_.back());
+                pool_.pop_back();
+                Entry* e = keys.find(c.key);
+                if (e && eligible(*e)) return e;
+            }
+        }
+        return nullptr;
+    }
+
+} // namespace redisx
@@ -0,0 +1,31 @@
+#include <redisx/core/expire_cycle.hpp>
+
+namespace redisx {
+
+    void ExpireCycle::arm(TimePoint at) {
+        timer_.expires_at(at);
+        timer_.async_wait([this](const asio::error_code& ec) {
+            if (!ec) run();
+        });
+    }
+
+    void ExpireCycle::run() {
+        const auto start = std::chrono::steady_clock::now();
+        if (start - period_start_ >= kPeriod) {
+            period_start_ = start;
+            used_ = Duration::zero();
+        }
+        const bool more = shard_.sweep(start, kBudget);
+        used_ += std::chrono::steady_clock::now() - start;
+        if (!more) {
+            arm(start + kPeriod);
+        }
+        else if (used_ < kMaxPerPeriod) {
+            asio::post(timer_.get_executor(), [this] { run(); });   // backlog: next slice
+        }
+        else {
+            arm(period_start_ + kPeriod);                           // this period's share is spent
+        }
+    }
+
+} // namespace redisx
@@ -0,0 +1,161 @@
+#include <redisx/core/keyspace.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace redisx {
+
+    static size_t varint_size(size_t n) {
+        size_t k = 1;
+        while (n >= 0x80) { n >>= 7; ++k; }
+        return k;
+    }
+
+    static char* write_varint(char* p, size_t n) {
+        while (n >= 0x80) {
+            *p++ = static_cast<char>(0x80 | (n & 0x7f));
+            n >>= 7;
+        }
+        *p++ = static_cast<char>(n);
+        return p;
+    }
+
+    static size_t pair_size(std::string_view field, std::string_view value) {
+        return varint_size(field.size()) + field.size() + varint_size(value.size()) + value.size();
+    }
+
+    static_assert(sizeof(HashValue) <= 32);
+
+    HashValue::HashValue(const HashValue& o) : arena_(o.arena_), count_(o.count_) {
+        if (o.converted_) {
+            table_ = slab_new<Table>(*arena_, *o.table_);
+            converted_ = true;
+        }
+        else if (o.len_) {
+            buf_ = static_cast<char*>(arena_->allocate(o.len_));
+            std::memcpy(buf_, o.buf_, o.len_);
+            len_ = cap_ = o.len_;
+        }
+    }
+
+    HashValue::~HashValue() {
+        if (converted_) slab_delete(*arena_, table_);
+        else if (buf_) arena_->deallocate(buf_, cap_);
+    }
+
+    size_t HashValue::find_packed(std::string_view field) const {
+        for (const char *p = buf_, *end = buf_ + len_; p != end;) {
+            const char* pair = p;
+            std::string_view k = read(p);
+            read(p);
+            if (k == field) return static_cast<size_t>(pair - buf_);
+        }
+        return len_;
+    }
+
+    std::optional<std::string_view> HashValue::find(std::string_view field) const {
+        if (converted_) {
+            auto it = table_->find(field);
+            if (it == table_->end()) return std::nullopt;
+            return std::string_view(it->second);
+        }
+        const size_t at = find_packed(field);
+        if (at == len_) return std::nullopt;
+        const char* p = buf_ + at;
+        read(p);
+        return read(p);
+    }
+
+    void HashValue::grow(size_t n) {
+        if (n <= cap_) return;
+        const size_t cap = std::max(n, size_t(cap_) + cap_ / 2);
+        char* b = static_cast<char*>(arena_->allocate(cap));
+        if (len_) std::memcpy(b, buf_, len_);
+        if (buf_) arena_->deallocate(buf_, cap_);
+        buf_ = b;
+        cap_ = static_cast<uint32_t>(cap);
+    }
+
+    // Replaces the pair at offset at (appends if at == len_), shifting the pairs after it.
+    void HashValue::put_packed(size_t at, std::string_view field, std::string_view value) {
+        size_t old = 0;
+        if (at != len_) {
+            const char* p = buf_ + at;
+            read(p);
+            read(p);
+            old = static_cast<size_t>(p - (buf_ + at));
+        }
+        const size_t n = pair_size(field, value);
+        const size_t len = len_ - old + n;
+        grow(len);
+        char* pair = buf_ + at;
+        std::memmove(pair + n, pair + old, len_ - at - old);
+        char* p = write_varint(pair, field.size());
+        std::memcpy(p, field.data(), field.size());
+        p = write_varint(p + field.size(), value.size());
+        std::memcpy(p, value.data(), value.size());
+        len_ = static_cast<uint32_t>(len);
+    }
+
+    void HashValue::convert() {
+        SlabArena& a = *arena_;
+        Table* t = slab_new<Table>(a, Table::allocator_type(a));
+        try {
+            t->reserve(count_);
+            for_each([&](std::string_view k, std::string_view v) {
+                t->emplace(ShardString(k, SlabAllocator<char>(a)), ShardString(v, SlabAllocator<char>(a)));
+                });
+        }
+        catch (...) {
+            slab_delete(a, t);
+            throw;
+        }
+        if (buf_) a.deallocate(buf_, cap_);
+        len_ = cap_ = count_ = 0;
+        table_ = t;
+        converted_ = true;
+    }
+
+    bool HashValue::set(std::string_view field, std::string_view value, const HashLimits& limits) {
+        if (!converted_) {
+            const size_t at = find_packed(field);
+            const bool added = at == len_;
+            const bool fits = field.size() <= limits.max_value && value.size() <= limits.max_value
+                && (!added || count_ < limits.max_entries)
+                && size_t(len_) + pair_size(field, value) <= UINT32_MAX;
+            if (fits) {
+                put_packed(at, field, value);
+                if (added) ++count_;
+                return added;
+            }
+            convert();
+        }
+        auto it = table_->find(field);
+        if (it != table_->end()) {
+            it->second.assign(value);
+            return false;
+        }
+        SlabAllocator<char> alloc(*arena_);
+        table_->emplace(ShardString(field, alloc), ShardString(value, alloc));
+        return true;
+    }
+
+    bool HashValue::erase(std::string_view field) {
+        if (converted_) {
+            auto it = table_->find(field);
+            if (it == table_->end()) return false;
+            table_->erase(it);
+            return true;
+        }
+        const size_t at = find_packed(field);
+        if (at == len_) return false;
+        const char* p = buf_ + at;
+        read(p);
+        read(p);
+        const size_t old = static_cast<size_t>(p - (buf_ + at));
+        std::memmove(buf_ + at, buf_ + at + old, len_ - at - old);
+        len_ -= static_cast<uint32_t>(old);
+        --count_;
+        return true;
+    }
+
+} // namespace redisx
@@ -0,0 +1,389 @@
+#include <redisx/core/keyspace.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define REDISX_KEYSPACE_SSE2 1
+#endif
+
+namespace redisx {
+
+    // std::hash also picks the shard (by its low bits), so remix before using it here
+    static uint64_t hash_of(std::string_view k) {
+        uint64_t h = std::hash<std::string_view>{}(k);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static int8_t tag_of(uint64_t h) { return static_cast<int8_t>(h & 0x7f); }
+
+    // bit i set where group byte i == b
+    static uint32_t match(const int8_t* g, int8_t b) {
+#ifdef REDISX_KEYSPACE_SSE2
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+        uint32_t m = 0;
+        for (int i = 0; i < 16; ++i) m |= uint32_t(g[i] == b) << i;
+        return m;
+#endif
+    }
+
+    // bit i set where group byte i is empty or deleted (the sign bit)
+    static uint32_t match_free(const int8_t* g) {
+#ifdef REDISX_KEYSPACE_SSE2
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(g))));
+#else
+        uint32_t m = 0;
+        for (int i = 0; i < 16; ++i) m |= uint32_t(g[i] < 0) << i;
+        return m;
+#endif
+    }
+
+    // Returns the pages of [p + from, p + to) to the system, keeping the block: the
+    // pages it shares with whatever lies around it stay, as do the ones that
+    // straddle to, which the next call that takes over from there gives back.
+    static void release_pages(void* p, size_t size, size_t from, size_t to) {
+#ifdef _WIN32
+        (void)p, (void)size, (void)from, (void)to;      // freed whole with the block
+#else
+        static const uintptr_t page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+        const uintptr_t base = reinterpret_cast<uintptr_t>(p);
+        const uintptr_t lo = std::max((base + page - 1) & ~(page - 1), (base + from) & ~(page - 1));
+        const uintptr_t hi = std::min(base + size, base + to) & ~(page - 1);
+        if (lo < hi) ::madvise(reinterpret_cast<void*>(lo), hi - lo, MADV_DONTNEED);
+#endif
+    }
+
+    Value string_value(std::string_view s, SlabArena& arena) {
+        if (s.size() < kSharedStringMin) return Value(ShardString(s, SlabAllocator<char>(arena)));
+        const size_t bytes = s.size();
+        arena.charge()->fetch_add(bytes, std::memory_order_relaxed);
+        return Value(SharedBytes(new std::string(s), [charge = arena.charge(), bytes](const std::string* p) {
+            charge->fetch_sub(bytes, std::memory_order_relaxed);
+            delete p;
+            }));
+    }
+
+    SlabPtr<HashValue> hash_value(SlabArena& arena, const HashValue* copy_of) {
+        HashValue* h = copy_of ? slab_new<HashValue>(arena, *copy_of)
+                               : slab_new<HashValue>(arena, arena);
+        return SlabPtr<HashValue>(h, { &arena });
+    }
+
+    Keyspace::~Keyspace() {
+        clear();
+    }
+
+    Entry* Keyspace::new_entry(std::string_view key, Value&& v, Entry::TimePoint expires) {
+        return slab_new<Entry>(arena_, ShardString(key, SlabAllocator<char>(arena_)), std::move(v), expires);
+    }
+
+    // Frees e now, or once no shared reader can hold it
+    void Keyspace::free_entry(Entry* e) {
+        if (!shared()) return slab_delete(arena_, e);
+        retired_->retire(e, [](void* p, void* arena) {
+            slab_delete(*static_cast<SlabArena*>(arena), static_cast<Entry*>(p));
+            }, &arena_);
+    }
+
+    // Not for shared mode while readers are about (only the destructor calls it there)
+    void Keyspace::clear() {
+        for (size_t i = 0; i < cap_; ++i) {
+            if (ctrl_[i] >= 0) slab_delete(arena_, slots_[i]);
+        }
+        for (size_t j = migrated_; j < old_cap_; ++j) {
+            if (old_ctrl_[j] >= 0) slab_delete(arena_, old_slots_[j]);
+        }
+        ctrl_.reset();
+        slots_.reset();
+        old_ctrl_.reset();
+        old_slots_.reset();
+        next_ctrl_.reset();
+        spent_ctrl_.reset();
+        spent_slots_.reset();
+        delete view_.exchange(nullptr);
+        cap_ = size_ = growth_left_ = old_cap_ = migrated_ = old_left_ = next_ready_ = spent_released_ = 0;
+    }
+
+    // Groups are aligned and probed triangularly (g, g+1, g+3, ...), which visits
+    // every group once since the group count is a power of two. A probe ends at the
+    // first group with an empty slot.
+    template <class Is>
+    size_t Keyspace::probe(const int8_t* ctrl, size_t cap, uint64_t h, Is&& is) {
+        if (cap == 0) return cap;
+        const size_t mask = cap / kGroupWidth - 1;
+        const int8_t tag = tag_of(h);
+        size_t g = (h >> 7) & mask;
+        for (size_t step = 1; step <= mask + 1; ++step) {
+            const int8_t* group = ctrl + g * kGroupWidth;
+            for (uint32_t m = match(group, tag); m; m &= m - 1) {
+                size_t i = g * kGroupWidth + std::countr_zero(m);
+                if (is(i)) return i;
+            }
+            if (match(group, kEmpty)) return cap;
+            g = (g + step) & mask;
+        }
+        return cap;
+    }
+
+    Entry* Keyspace::find(std::string_view key, uint64_t h) const {
+        size_t i = probe(ctrl_.get(), cap_, h, [&](size_t i) { return slots_[i]->key == key; });
+        if (i != cap_) return slots_[i];
+        if (old_cap_ == 0) return nullptr;
+        size_t j = probe(old_ctrl_.get(), old_cap_, h, [&](size_t j) { return old_slots_[j]->key == key; });
+        return j == old_cap_ ? nullptr : old_slots_[j];
+    }
+
+    Entry* Keyspace::find(std::string_view key) const {
+        return find(key, hash_of(key));
+    }
+
+    // probe() over published arrays, one atomic byte at a time. Slots are filled
+    // before their control byte and emptied after it, so a matching tag leads to
+    // the entry, to nullptr, or to an entry retired but not yet freed.
+    const Entry* Keyspace::probe_shared(const int8_t* ctrl, Entry* const* slots, size_t cap, std::string_view key, uint64_t h) {
+        const size_t mask = cap / kGroupWidth - 1;
+        const int8_t tag = tag_of(h);
+        size_t g = (h >> 7) & mask;
+        for (size_t step = 1; step <= mask + 1; ++step) {
+            bool has_empty = false;
+            for (size_t i = g * kGroupWidth; i < (g + 1) * kGroupWidth; ++i) {
+                const int8_t c = std::atomic_ref<const int8_t>(ctrl[i]).load(std::memory_order_acquire);
+                if (c == kEmpty) has_empty = true;
+                if (c != tag) continue;
+                const Entry* e = std::atomic_ref<Entry* const>(slots[i]).load(std::memory_order_acquire);
+                if (e && e->key == key) return e;
+            }
+            if (has_empty) return nullptr;
+            g = (g + step) & mask;
+        }
+        return nullptr;
+    }
+
+    // A view from before a rehash started only has the old arrays, which keep every
+    // entry they had, changes included, until the view is retired.
+    const Entry* Keyspace::find_shared(std::string_view key) const {
+        const View* v = view_.load(std::memory_order_acquire);
+        if (!v) return nullptr;
+        const uint64_t h = hash_of(key);
+        if (const Entry* e = probe_shared(v->ctrl, v->slots, v->cap, key, h)) return e;
+        return v->old_cap ? probe_shared(v->old_ctrl, v->old_slots, v->old_cap, key, h) : nullptr;
+    }
+
+    std::pair<Entry*, bool> Keyspace::emplace(std::string_view key, Value&& init) {
+        rehash(kRehashStep);
+        const uint64_t h = hash_of(key);
+        if (Entry* e = find(key, h)) return { e, false };
+
+        prepare_growth();
+        if (growth_left_ == 0) {
+            // mostly tombstones: clean up in place; otherwise double
+            if (cap_ != 0 && size_ < cap_ * 7 / 16) resize(cap_);
+            else resize(cap_ == 0 ? kGroupWidth : cap_ * 2);
+        }
+
+        const size_t mask = cap_ / kGroupWidth - 1;
+        size_t g = (h >> 7) & mask;
+        for (size_t step = 1;; ++step) {
+            int8_t* ctrl = ctrl_.get() + g * kGroupWidth;
+            if (uint32_t m = match_free(ctrl)) {
+                size_t i = g * kGroupWidth + std::countr_zero(m);
+                if (ctrl_[i] == kEmpty) --growth_left_;
+                put_slot(slots_.get(), i, new_entry(key, std::move(init), Entry::kNoExpiry));
+                put_ctrl(ctrl_.get(), i, tag_of(h));
+                ++size_;
+                return { slots_[i], true };
+            }
+            g = (g + step) & mask;
+        }
+    }
+
+    bool Keyspace::erase(std::string_view key) {
+        Entry* e = find(key);
+        if (!e) return false;
+        erase(e);
+        return true;
+    }
+
+    void Keyspace::erase(Entry* e) {
+        rehash(kRehashStep);
+        const uint64_t h = hash_of(e->key);
+        if (old_cap_) {
+            size_t j = probe(old_ctrl_.get(), old_cap_, h, [&](size_t j) { return old_slots_[j] == e; });
+            if (j != old_cap_) {
+                // its slot in the new arrays, if copied, is reserved already
+                put_ctrl(old_ctrl_.get(), j, kDeleted);
+                put_slot(old_slots_.get(), j, nullptr);
+                if (j >= migrated_) {
+                    --size_;
+                    --old_left_;
+                    return free_entry(e);
+                }
+            }
+        }
+        erase_at(probe(ctrl_.get(), cap_, h, [&](size_t i) { return slots_[i] == e; }));
+    }
+
+    Entry* Keyspace::assign(Entry* e, Value v) {
+        if (!shared()) {
+            e->value = std::move(v);
+            return e;
+        }
+        Entry* fresh = new_entry(e->key, std::move(v), e->expires);
+        fresh->access = e->load_access();
+        const uint64_t h = hash_of(e->key);
+        size_t i = probe(ctrl_.get(), cap_, h, [&](size_t i) { return slots_[i] == e; });
+        if (i != cap_) put_slot(slots_.get(), i, fresh);
+        if (old_cap_) {
+            size_t j = probe(old_ctrl_.get(), old_cap_, h, [&](size_t j) { return old_slots_[j] == e; });
+            if (j != old_cap_) put_slot(old_slots_.get(), j, fresh);
+        }
+        free_entry(e);
+        return fresh;
+    }
+
+    void Keyspace::erase_at(size_t i) {
+        Entry* e = slots_[i];
+        --size_;
+        // A group that still has an empty slot has never been full, so no probe
+        // has gone past it and the slot can become empty again. Otherwise leave a
+        // tombstone to keep longer probe chains intact.
+        const int8_t* group = ctrl_.get() + (i / kGroupWidth) * kGroupWidth;
+        if (match(group, kEmpty)) {
+            put_ctrl(ctrl_.get(), i, kEmpty);
+            ++growth_left_;
+        }
+        else {
+            put_ctrl(ctrl_.get(), i, kDeleted);
+        }
+        put_slot(slots_.get(), i, nullptr);
+        free_entry(e);
+    }
+
+    // Starts a rehash into new arrays of new_cap slots, finishing any previous one
+    // first. growth_left_ holds back a slot for every entry still to be copied.
+    void Keyspace::resize(size_t new_cap) {
+        if (old_cap_ != 0) rehash(SIZE_MAX);
+        if (cap_ != 0) {
+            old_ctrl_ = std::move(ctrl_);
+            old_slots_ = std::move(slots_);
+            old_cap_ = cap_;
+            migrated_ = 0;
+            old_left_ = size_;
+        }
+        if (next_ctrl_ && next_ctrl_.get_deleter().n == new_cap) {
+            ctrl_ = std::move(next_ctrl_);
+            std::memset(ctrl_.get() + next_ready_, kEmpty, new_cap - next_ready_);
+        }
+        else {
+            ctrl_ = slab_array<int8_t>(arena_, new_cap);
+            std::memset(ctrl_.get(), kEmpty, new_cap);
+        }
+        next_ctrl_.reset();
+        next_ready_ = 0;
+        slots_ = slab_array<Entry*>(arena_, new_cap);     // read only where ctrl_ says full
+        cap_ = new_cap;
+        growth_left_ = new_cap * 7 / 8 - size_;   // max load factor 7/8
+
+        if (shared()) {
+            View* prev = view_.exchange(new View{ cap_, ctrl_.get(), slots_.get(), old_cap_, old_ctrl_.get(), old_slots_.get() },
+                std::memory_order_acq_rel);
+            if (prev) retired_->retire(prev);
+        }
+    }
+
+    void Keyspace::reserve(size_t n) {
+        if (n <= size_ + growth_left_) return;
+        size_t cap = std::max(cap_, kGroupWidth);
+        while (cap * 7 / 8 < n) cap *= 2;
+        resize(cap);
+        rehash(SIZE_MAX);
+    }
+
+    // Starts once the table is 15/16 of the way to its next doubling, which leaves
+    // twice the inserts needed to get through the new control bytes.
+    void Keyspace::prepare_growth() {
+        if (cap_ < kPrepareMin || growth_left_ > cap_ / 16) return;
+        const size_t n = cap_ * 2;
+        if (!next_ctrl_) next_ctrl_ = slab_array<int8_t>(arena_, n);
+        const size_t k = std::min(kPrepareStep, n - next_ready_);
+        std::memset(next_ctrl_.get() + next_ready_, kEmpty, k);
+        next_ready_ += k;
+    }
+
+    // An earlier pair not given back yet is freed whole, which growth leaves no
+    // time for: doubling again takes more writes than releasing these.
+    void Keyspace::spend(SlabArray<int8_t> ctrl, SlabArray<Entry*> slots) {
+        spent_ctrl_ = std::move(ctrl);
+        spent_slots_ = std::move(slots);
+        spent_released_ = 0;
+    }
+
+    bool Keyspace::release_spent(size_t pages) {
+        if (!spent_slots_) return false;
+        const size_t slot_bytes = spent_slots_.get_deleter().n * sizeof(Entry*);
+        const size_t ctrl_bytes = spent_ctrl_.get_deleter().n;
+        const size_t left = slot_bytes + ctrl_bytes - spent_released_;
+        if (pages < left / kReleasePage) {
+            const size_t from = spent_released_, to = from + pages * kReleasePage;
+            if (from < slot_bytes) release_pages(spent_slots_.get(), slot_bytes, from, to);
+            if (to > slot_bytes) release_pages(spent_ctrl_.get(), ctrl_bytes, from > slot_bytes ? from - slot_bytes : 0, to - slot_bytes);
+            spent_released_ = to;
+            return true;
+        }
+        spent_ctrl_.reset();            // what is left of them, at most a few pages
+        spent_slots_.reset();
+        spent_released_ = 0;
+        return false;
+    }
+
+    // Copies into empty slots only: those were set aside for it by resize().
+    bool Keyspace::rehash(size_t n) {
+        if (old_cap_ == 0) return release_spent(n);
+        const size_t end = n >= old_cap_ - migrated_ ? old_cap_ : migrated_ + n;
+        const size_t mask = cap_ / kGroupWidth - 1;
+        for (; migrated_ < end; ++migrated_) {
+            if (old_ctrl_[migrated_] < 0) continue;
+            Entry* e = old_slots_[migrated_];
+            const uint64_t h = hash_of(e->key);
+            size_t g = (h >> 7) & mask;
+            for (size_t step = 1;; ++step) {
+                if (uint32_t m = match(ctrl_.get() + g * kGroupWidth, kEmpty)) {
+                    size_t i = g * kGroupWidth + std::countr_zero(m);
+                    put_slot(slots_.get(), i, e);
+                    put_ctrl(ctrl_.get(), i, tag_of(h));
+                    --old_left_;
+                    break;
+                }
+                g = (g + step) & mask;
+            }
+        }
+        if (migrated_ < old_cap_) return true;
+
+        if (shared()) {
+            // readers may still be probing the old arrays; once none can, they are spent
+            View* old_view = view_.exchange(new View{ cap_, ctrl_.get(), slots_.get(), 0, nullptr, nullptr }, std::memory_order_acq_rel);
+            retired_->retire(new OldTable{ std::move(old_ctrl_), std::move(old_slots_), std::unique_ptr<View>(old_view) },
+                [](void* p, void* keys) {
+                    std::unique_ptr<OldTable> t(static_cast<OldTable*>(p));
+                    static_cast<Keyspace*>(keys)->spend(std::move(t->ctrl), std::move(t->slots));
+                }, this);
+        }
+        else {
+            spend(std::move(old_ctrl_), std::move(old_slots_));
+        }
+        old_cap_ = migrated_ = 0;
+        return static_cast<bool>(spent_slots_);
+    }
+
+} // namespace redisx
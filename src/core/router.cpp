@@ -1,338 +1,871 @@
 #include <redisx/core/router.hpp>
+#include <redisx/persistence/aof.hpp>
+#include <redisx/persistence/snapshot.hpp>
 #include <redisx/proto/resp.hpp>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
 
 
 namespace redisx {
 
-    static std::string upper(std::string s) {
-        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::toupper(c); });
-        return s;
+    using Args = Router::Args;
+
+    static constexpr char ascii_upper(char c) {
+        return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
     }
 
-    static inline std::string resp_wrongtype() {
-        return "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+    static constexpr char ascii_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
     }
 
+    // case-insensitive compare against an upper-case literal
+    static constexpr bool iequals(std::string_view s, std::string_view upper) {
+        if (s.size() != upper.size()) return false;
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (ascii_upper(s[i]) != upper[i]) return false;
+        }
+        return true;
+    }
 
-    Router::Router(Store& s) : store_(s) {
-        h_["PING"] = [](auto const& a) {
-            if (a.size() > 1) return resp_bulk(a[1]);
-            return resp_simple("PONG");
-            };
+    // strict integer argument parse (no allocation, unlike std::stoll)
+    static bool to_ll(std::string_view s, long long& out) {
+        auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+        return ec == std::errc{} && p == s.data() + s.size();
+    }
 
-        h_["ECHO"] = [](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'echo'");
-            return resp_bulk(a[1]);
-            };
+    // ---- command handlers ----------------------------------------------------
+    // Arity has already been checked against the command table by dispatch().
 
-        h_["SET"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'set'");
-            store_.shard_for(a[1]).set(a[1], a[2]);
-            return resp_simple("OK");
-            };
+    static void cmd_ping(Router&, Args a, RespWriter& w) {
+        if (a.size() > 1) return w.bulk(a[1]);
+        return w.raw(reply::pong);
+    }
 
-        h_["GET"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'get'");
-            const std::string& key = a[1];
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
+    static void cmd_echo(Router&, Args a, RespWriter& w) {
+        return w.bulk(a[1]);
+    }
 
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::Hash) return resp_wrongtype();
+    // A string value as a bulk; one stored shared is sent by reference.
+    static void bulk_value(RespWriter& w, const Entry& e) {
+        if (const SharedBytes* b = e.shared_str()) return w.bulk(*b);
+        return w.bulk(*e.str());
+    }
 
-            auto v = sh.get(key);                                   // lazily evicts expired
-            if (!v) return resp_nil();
-            return resp_bulk(*v);
-            };
+    static void cmd_get(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        const Entry* e = nullptr;
+        switch (sh.get_string_checked(key, ttl::coarse_now(), e)) {
+        case OpStatus::WrongType: return w.raw(reply::wrongtype);
+        case OpStatus::NotFound:  return w.nil();
+        case OpStatus::Ok:        return bulk_value(w, *e);
+        }
+    }
 
+    // GET in shared-read mode, on the caller's thread
+    static bool cmd_get_shared(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto st = r.store().shard_for(key).read_shared(key, ttl::coarse_now(), [&](const Entry& e) {
+            if (!e.str()) return OpStatus::WrongType;
+            bulk_value(w, e);
+            return OpStatus::Ok;
+        });
+        if (st == OpStatus::WrongType) w.raw(reply::wrongtype);
+        else if (st == OpStatus::NotFound) w.nil();
+        return true;
+    }
 
-        h_["DEL"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'del'");
-            bool ok = store_.shard_for(a[1]).del(a[1]);
-            return resp_int(ok ? 1 : 0);
-            };
+    // ---- append-only log ------------------------------------------------------
 
-        h_["EXPIRE"] = [this](auto const& a) {
-            // EXPIRE key seconds  -> returns 1 if TTL set, 0 otherwise
-            if (a.size() < 3) return resp_error("wrong number of arguments for 'expire'");
-            const std::string& key = a[1];
-            long long sec = 0;
-            try { sec = std::stoll(a[2]); }
-            catch (...) { return resp_error("value is not an integer or out of range"); }
-            if (sec < 0) sec = 0;
-            auto& sh = store_.shard_for(key);
-            // check existence by get (which also lazily evicts)
-            auto cur = sh.get(key);
-            if (!cur) return resp_int(0);
-            auto tp = std::chrono::steady_clock::now() + std::chrono::seconds(sec);
-            sh.set_expire(key, tp);
-            return resp_int(1);
-            };
+    // Logs a write the handler has applied; it runs on the thread of key's shard.
+    static void log_write(Router& r, std::string_view key, Args cmd) {
+        if (AppendLog* aof = r.append_log()) aof->append(r.store().shard_index(key), cmd);
+    }
 
-        h_["TTL"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong number of arguments for 'ttl'");
-            const std::string& key = a[1];
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            long long ms = sh.ttl_ms(key, now);
-            if (ms == -2) return resp_int(-2);
-            if (ms == -1) return resp_int(-1);
-            long long secs = (ms + 999) / 1000; // ceil ms -> s
-            return resp_int(secs);
-            };
+    // Deadlines are logged as wall-clock time, which a replay can still use
+    static void log_deadline(Router& r, std::string_view key, std::string_view unix_ms) {
+        const std::string_view cmd[] = { "PEXPIREAT", key, unix_ms };
+        log_write(r, key, cmd);
+    }
 
-        // SET with EX/PX (only EX or PX, not both)
-        h_["SET"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'set'");
-            const std::string& key = a[1];
-            const std::string& val = a[2];
-
-            // parse optional EX/PX
-            long long ttl_ms = -1;
-            if (a.size() >= 5) {
-                // pattern: SET k v EX 10  |  SET k v PX 1500
-                std::string opt = a[3];
-                std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
-                if (opt == "EX") {
-                    try { ttl_ms = std::stoll(a[4]) * 1000; }
-                    catch (...) { return resp_error("value is not an integer or out of range"); }
-                }
-                else if (opt == "PX") {
-                    try { ttl_ms = std::stoll(a[4]); }
-                    catch (...) { return resp_error("value is not an integer or out of range"); }
-                }
-                else {
-                    return resp_error("syntax error");
-                }
-                if (ttl_ms < 0) ttl_ms = 0;
-            }
-            else if (a.size() != 3) {
-                // any other arity like SET k v EX (missing number)
-                return resp_error("syntax error");
-            }
+    static void log_deadline(Router& r, std::string_view key, ttl::TimePt tp) {
+        if (r.append_log()) log_deadline(r, key, std::to_string(unix_ms_at(tp)));
+    }
 
-            auto& sh = store_.shard_for(key);
-            sh.set(key, val);
-            if (ttl_ms >= 0) {
-                auto tp = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl_ms);
-                sh.set_expire(key, tp);
-            }
-            return resp_simple("OK");
-            };
+    // DEL key [key ...]
+    static void cmd_del(Router& r, Args a, RespWriter& w) {
+        long long n = 0;
+        std::vector<std::string_view> deleted;      // for the log: the keys that were there
+        for (size_t i = 1; i < a.size(); ++i) {
+            if (!r.store().shard_for(a[i]).del(a[i])) continue;
+            ++n;
+            if (r.append_log()) deleted.push_back(a[i]);
+        }
+        if (!deleted.empty()) {
+            deleted.insert(deleted.begin(), "DEL");
+            log_write(r, deleted[1], deleted);
+        }
+        return w.integer(n);
+    }
 
-        // PEXPIRE key ms
-        h_["PEXPIRE"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'pexpire'");
-            const std::string& key = a[1];
-            long long ms = 0;
-            try { ms = std::stoll(a[2]); }
-            catch (...) { return resp_error("value is not an integer or out of range"); }
-            if (ms < 0) ms = 0;
-            auto& sh = store_.shard_for(key);
-            auto cur = sh.get(key);      // lazily evicts if expired
-            if (!cur) return resp_int(0);
-            sh.set_expire(key, std::chrono::steady_clock::now() + std::chrono::milliseconds(ms));
-            return resp_int(1);
-            };
+    // TTLs are clamped to [0, kMaxTtlMs]. steady_clock counts nanoseconds since boot
+    // in 64 bits, about 292 years, so a deadline a century out never overflows it.
+    static constexpr long long kMaxTtlMs = 100LL * 365 * 24 * 3600 * 1000;
 
-        // PERSIST key (remove TTL)
-        h_["PERSIST"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'persist'");
-            const std::string& key = a[1];
-            auto& sh = store_.shard_for(key);
+    static long long clamp_ttl_ms(long long ms) { return std::clamp<long long>(ms, 0, kMaxTtlMs); }
 
-            // Check existence (also lazily evicts if expired)
-            auto v = sh.get(key);
-            if (!v) return resp_int(0);
+    static long long clamp_ttl_sec(long long sec) {
+        if (sec <= 0) return 0;
+        return sec > kMaxTtlMs / 1000 ? kMaxTtlMs : sec * 1000;
+    }
 
-            // If key exists, just erase TTL metadata
-            sh.clear_expire(key);
-            return resp_int(1);
-            };
+    static void cmd_expire(Router& r, Args a, RespWriter& w) {
+        // EXPIRE key seconds  -> returns 1 if TTL set, 0 otherwise
+        std::string_view key = a[1];
+        long long sec = 0;
+        if (!to_ll(a[2], sec)) return w.error("value is not an integer or out of range");
+        auto now = ttl::coarse_now();
+        const auto tp = now + std::chrono::milliseconds(clamp_ttl_sec(sec));
+        if (!r.store().shard_for(key).expire_if_exists(key, tp, now)) return w.integer(0);
+        log_deadline(r, key, tp);
+        return w.integer(1);
+    }
 
-        h_["EXISTS"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'exists'");
-            long long count = 0;
-            auto now = std::chrono::steady_clock::now();
-            for (size_t i = 1; i < a.size(); ++i) {
-                const std::string& key = a[i];
-                auto& sh = store_.shard_for(key);
-                auto t = sh.type_of(key, now);
-                if (t != ValueType::None) ++count;
+    static void cmd_ttl(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        auto now = ttl::coarse_now();
+        long long ms = sh.ttl_ms(key, now);
+        if (ms == -2) return w.integer(-2);
+        if (ms == -1) return w.integer(-1);
+        long long secs = (ms + 999) / 1000; // ceil ms -> s
+        return w.integer(secs);
+    }
+
+    // SET with EX/PX (only EX or PX, not both)
+    static void cmd_set(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        std::string_view val = a[2];
+
+        // parse optional EX/PX
+        long long ttl_ms = -1;
+        bool precise = false;
+        if (a.size() >= 5) {
+            // pattern: SET k v EX 10  |  SET k v PX 1500
+            if (iequals(a[3], "EX")) {
+                if (!to_ll(a[4], ttl_ms)) return w.error("value is not an integer or out of range");
+                ttl_ms = clamp_ttl_sec(ttl_ms);
             }
-            return resp_int(count);
-            };
+            else if (iequals(a[3], "PX")) {
+                if (!to_ll(a[4], ttl_ms)) return w.error("value is not an integer or out of range");
+                precise = true;
+            }
+            else {
+                return w.error("syntax error");
+            }
+            ttl_ms = clamp_ttl_ms(ttl_ms);
+        }
+        else if (a.size() != 3) {
+            // any other arity like SET k v EX (missing number)
+            return w.error("syntax error");
+        }
+
+        auto& sh = r.store().shard_for(key);
+        if (!sh.make_room(ttl::coarse_now())) return w.raw(reply::oom);
+        sh.set(key, val);
+        log_write(r, key, a.first(3));
+        if (ttl_ms >= 0) {
+            const auto now = precise ? ttl::now() : ttl::coarse_now();
+            const auto tp = now + std::chrono::milliseconds(ttl_ms);
+            sh.set_expire(key, tp, now);
+            log_deadline(r, key, tp);
+        }
+        return w.ok();
+    }
+
+    // PEXPIRE key ms
+    static void cmd_pexpire(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        long long ms = 0;
+        if (!to_ll(a[2], ms)) return w.error("value is not an integer or out of range");
+        auto now = ttl::now();      // precise: a coarse base would fire short TTLs early
+        const auto tp = now + std::chrono::milliseconds(clamp_ttl_ms(ms));
+        if (!r.store().shard_for(key).expire_if_exists(key, tp, now)) return w.integer(0);
+        log_deadline(r, key, tp);
+        return w.integer(1);
+    }
+
+    // PEXPIREAT key unix-ms / EXPIREAT key unix-s: a deadline in wall-clock time,
+    // possibly past (the key then expires at once). What is logged is the deadline
+    // as applied, after clamping.
+    static void expire_at(Router& r, std::string_view key, long long unix_ms, RespWriter& w) {
+        using namespace std::chrono;
+        const long long unix_now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+        // unix_now is positive, so only a very negative unix_ms can overflow this
+        const long long from_now = unix_ms < LLONG_MIN + unix_now ? 0 : clamp_ttl_ms(unix_ms - unix_now);
+        auto now = ttl::now();
+        if (!r.store().shard_for(key).expire_if_exists(key, now + milliseconds(from_now), now)) return w.integer(0);
+        if (r.append_log()) log_deadline(r, key, std::to_string(unix_now + from_now));
+        return w.integer(1);
+    }
+
+    static void cmd_pexpireat(Router& r, Args a, RespWriter& w) {
+        long long ms = 0;
+        if (!to_ll(a[2], ms)) return w.error("value is not an integer or out of range");
+        expire_at(r, a[1], ms, w);
+    }
 
-        // HSET key field value
-        h_["HSET"] = [this](auto const& a) {
-            if (a.size() < 4 || ((a.size() - 2) % 2 != 0))
-                return resp_error("wrong #args for 'hset'");
+    static void cmd_expireat(Router& r, Args a, RespWriter& w) {
+        long long sec = 0;
+        if (!to_ll(a[2], sec) || sec > LLONG_MAX / 1000 || sec < LLONG_MIN / 1000) {
+            return w.error("value is not an integer or out of range");
+        }
+        expire_at(r, a[1], sec * 1000, w);
+    }
 
-            const std::string& key = a[1];
-            auto& sh = store_.shard_for(key);
+    // PERSIST key (remove TTL)
+    static void cmd_persist(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        if (!r.store().shard_for(key).persist_if_exists(key, ttl::coarse_now())) return w.integer(0);
+        log_write(r, key, a);
+        return w.integer(1);
+    }
 
-            auto now = std::chrono::steady_clock::now();
+    static void cmd_exists(Router& r, Args a, RespWriter& w) {
+        long long count = 0;
+        auto now = ttl::coarse_now();
+        for (size_t i = 1; i < a.size(); ++i) {
+            std::string_view key = a[i];
+            auto& sh = r.store().shard_for(key);
             auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype();
+            if (t != ValueType::None) ++count;
+        }
+        return w.integer(count);
+    }
+
+    // HSET key field value [field value ...]
+    static void cmd_hset(Router& r, Args a, RespWriter& w) {
+        if ((a.size() - 2) % 2 != 0) return w.error("wrong #args for 'hset'");
+
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        if (!sh.make_room(ttl::coarse_now())) return w.raw(reply::oom);
+        long long added = 0;   // new fields; updated ones don't count
+        if (sh.hset_checked(key, a.subspan(2), ttl::coarse_now(), added) == OpStatus::WrongType) {
+            return w.raw(reply::wrongtype);
+        }
+        log_write(r, key, a);
+        return w.integer(added);
+    }
+
+    // HGET key field
+    static void cmd_hget(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        std::string_view v;
+        switch (sh.hget_checked(key, a[2], ttl::coarse_now(), v)) {
+        case OpStatus::WrongType: return w.raw(reply::wrongtype);
+        case OpStatus::NotFound:  return w.nil();
+        case OpStatus::Ok:        return w.bulk(v);
+        }
+    }
 
-            int added = 0;
-            for (size_t i = 2; i + 1 < a.size(); i += 2) {
-                const std::string& field = a[i];
-                const std::string& value = a[i + 1];
-                added += sh.hset(key, field, value); // 1 if new field, 0 if updated
+    // HGET in shared-read mode, on the caller's thread
+    // Only packed hashes are read here: converted ones are written in place
+    static bool cmd_hget_shared(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        bool converted = false;
+        auto st = r.store().shard_for(key).read_shared(key, ttl::coarse_now(), [&](const Entry& e) {
+            const HashValue* h = e.hash();
+            if (!h) return OpStatus::WrongType;
+            if (!h->packed()) {
+                converted = true;
+                return OpStatus::NotFound;
             }
-            return resp_int(added);
-            };
+            auto v = h->find(a[2]);
+            if (!v) return OpStatus::NotFound;
+            w.bulk(*v);
+            return OpStatus::Ok;
+        });
+        if (converted) return false;
+        if (st == OpStatus::WrongType) w.raw(reply::wrongtype);
+        else if (st == OpStatus::NotFound) w.nil();
+        return true;
+    }
 
-        // HGET key field
-        h_["HGET"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'hget'");
-            const std::string& key = a[1];
-            const std::string& field = a[2];
+    // HDEL key field [field ...]
+    static void cmd_hdel(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        long long removed = 0;
+        if (sh.hdel_checked(key, a.subspan(2), ttl::coarse_now(), removed) == OpStatus::WrongType) {
+            return w.raw(reply::wrongtype);
+        }
+        if (removed) log_write(r, key, a);
+        return w.integer(removed);
+    }
 
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype();
+    // HEXISTS key field
+    static void cmd_hexists(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        const HashValue* h = nullptr;
+        switch (sh.hash_checked(key, ttl::coarse_now(), h)) {
+        case OpStatus::WrongType: return w.raw(reply::wrongtype);
+        case OpStatus::NotFound:  return w.integer(0);
+        case OpStatus::Ok:        return w.integer(h->find(a[2]).has_value());
+        }
+    }
 
-            auto v = sh.hget(key, field);
-            if (!v) return resp_nil();
-            return resp_bulk(*v);
-            };
+    // HLEN key
+    static void cmd_hlen(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        const HashValue* h = nullptr;
+        switch (sh.hash_checked(key, ttl::coarse_now(), h)) {
+        case OpStatus::WrongType: return w.raw(reply::wrongtype);
+        case OpStatus::NotFound:  return w.integer(0);
+        case OpStatus::Ok:        return w.integer(static_cast<long long>(h->size()));
+        }
+    }
 
-        // HDEL key field
-        h_["HDEL"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'hdel'");
-            const std::string& key = a[1];
-            const std::string& field = a[2];
+    // HGETALL key  -> array: [field, value, field, value, ...]
+    static void cmd_hgetall(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        const HashValue* h = nullptr;
+        switch (sh.hash_checked(key, ttl::coarse_now(), h)) {
+        case OpStatus::WrongType: return w.raw(reply::wrongtype);
+        case OpStatus::NotFound:  return w.array(0);
+        case OpStatus::Ok:
+            w.array(h->size() * 2);
+            h->for_each([&](std::string_view f, std::string_view v) {
+                w.bulk(f);
+                w.bulk(v);
+            });
+            return;
+        }
+    }
 
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype();
+    static void cmd_type(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        auto now = ttl::coarse_now();
+        switch (sh.type_of(key, now)) {
+        case ValueType::None:   return w.bulk("none");
+        case ValueType::String: return w.bulk("string");
+        case ValueType::Hash:   return w.bulk("hash");
+        }
+        return w.bulk("none");
+    }
 
-            int removed = sh.hdel(key, field);
-            return resp_int(removed);
-            };
+    static void cmd_mget(Router& r, Args a, RespWriter& w) {
+        auto now = ttl::coarse_now();
+        // replies are written as we go; a hash anywhere discards them for -WRONGTYPE
+        const std::size_t mark = w.size();
+        w.array(a.size() - 1);
+        for (size_t i = 1; i < a.size(); ++i) {
+            const Entry* e = nullptr;
+            switch (r.store().shard_for(a[i]).get_string_checked(a[i], now, e)) {
+            case OpStatus::WrongType:
+                w.rewind(mark);
+                return w.raw(reply::wrongtype);
+            case OpStatus::NotFound: w.nil(); break;
+            case OpStatus::Ok:       bulk_value(w, *e); break;
+            }
+        }
+    }
 
-        // HEXISTS key field
-        h_["HEXISTS"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'hexists'");
-            const std::string& key = a[1];
-            const std::string& field = a[2];
+    static void cmd_hmget(Router& r, Args a, RespWriter& w) {
+        std::string_view key = a[1];
+        auto& sh = r.store().shard_for(key);
+        const HashValue* h = nullptr;
+        auto st = sh.hash_checked(key, ttl::coarse_now(), h);
+        if (st == OpStatus::WrongType) return w.raw(reply::wrongtype);
+
+        w.array(a.size() - 2);
+        for (size_t i = 2; i < a.size(); ++i) {
+            if (!h) { w.nil(); continue; }
+            auto v = h->find(a[i]);
+            if (!v) w.nil();
+            else w.bulk(*v);
+        }
+    }
 
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype();
+    static void cmd_mset(Router& r, Args a, RespWriter& w) {
+        if ((a.size() - 1) % 2 != 0) return w.error("wrong #args for 'mset'");
+        auto now = ttl::coarse_now();
+        for (size_t i = 1; i + 1 < a.size(); i += 2) {
+            if (!r.store().shard_for(a[i]).make_room(now)) return w.raw(reply::oom);    // all or nothing, as fan_out does across shards
+        }
+        for (size_t i = 1; i + 1 < a.size(); i += 2) {
+            std::string_view key = a[i];
+            std::string_view val = a[i + 1];
+            r.store().shard_for(key).set(key, val);
+        }
+        log_write(r, a[1], a);          // MSET only runs whole when its keys share a shard
+        return w.ok();
+    }
 
-            int ex = sh.hexists(key, field);
-            return resp_int(ex);
-            };
+    static void write_memory(const SlabArena::Stats& m, size_t evicted, RespWriter& w) {
+        w.bulk("used.bytes");   w.integer(static_cast<long long>(m.used));
+        w.bulk("slab.bytes");   w.integer(static_cast<long long>(m.slabs));
+        w.bulk("large.bytes");  w.integer(static_cast<long long>(m.large));
+        w.bulk("shared.bytes"); w.integer(static_cast<long long>(m.external));
+        w.bulk("blocks");       w.integer(static_cast<long long>(m.blocks));
+        w.bulk("evicted.keys"); w.integer(static_cast<long long>(evicted));
+    }
 
-        // HLEN key
-        h_["HLEN"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'hlen'");
-            const std::string& key = a[1];
+    // MEMORY STATS -> flat name/value array: totals, then "shard.<i>" -> its own
+    // name/value array. Counters are read without stopping the shards.
+    static void cmd_memory(Router& r, Args a, RespWriter& w) {
+        if (!iequals(a[1], "STATS") || a.size() != 2) return w.error("unknown subcommand for 'memory'");
+        const size_t n = r.store().shard_count();
+        std::vector<SlabArena::Stats> shards(n);
+        std::vector<size_t> evicted(n);
+        SlabArena::Stats total;
+        size_t total_evicted = 0;
+        for (size_t i = 0; i < n; ++i) {
+            shards[i] = r.store().shard_by_index(i).memory();
+            evicted[i] = r.store().shard_by_index(i).evicted();
+            total_evicted += evicted[i];
+            const auto& m = shards[i];
+            total.used += m.used;
+            total.slabs += m.slabs;
+            total.large += m.large;
+            total.external += m.external;
+            total.blocks += m.blocks;
+        }
+        w.array(2 + 12 + 2 * n);
+        w.bulk("shards");
+        w.integer(static_cast<long long>(n));
+        write_memory(total, total_evicted, w);
+        for (size_t i = 0; i < n; ++i) {
+            w.bulk("shard." + std::to_string(i));
+            w.array(12);
+            write_memory(shards[i], evicted[i], w);
+        }
+    }
 
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype();
+    // SAVE: holds up the calling connection until written; each shard only while
+    // it copies out its records
+    static void cmd_save(Router& r, Args, RespWriter& w) {
+        Snapshot* snap = r.snapshot();
+        if (!snap) return w.error("snapshots are not enabled");
+        std::string error;
+        if (!snap->save(error)) return w.error(error);
+        w.ok();
+    }
 
-            long long n = sh.hlen(key);
-            return resp_int(n);
-            };
+    static void cmd_bgsave(Router& r, Args, RespWriter& w) {
+        Snapshot* snap = r.snapshot();
+        if (!snap) return w.error("snapshots are not enabled");
+        std::string error;
+        if (!snap->save_in_background(error)) return w.error(error);
+        w.simple("Background saving started");
+    }
 
-        // HGETALL key  -> array: [field, value, field, value, ...]
-        h_["HGETALL"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'hgetall'");
-            const std::string& key = a[1];
+    static void cmd_bgrewriteaof(Router& r, Args, RespWriter& w) {
+        AppendLog* aof = r.append_log();
+        if (!aof) return w.error("the append only file is not enabled");
+        std::string error;
+        if (!aof->rewrite_in_background(error)) return w.error(error);
+        w.simple("Background append only file rewriting started");
+    }
 
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype();
+    static void cmd_lastsave(Router& r, Args, RespWriter& w) {
+        Snapshot* snap = r.snapshot();
+        w.integer(snap ? snap->last_save() : 0);
+    }
 
-            auto vec = sh.hgetall(key);
-            return resp_array(vec, /*as_bulk=*/true);
+    // INFO [section]: only the persistence section, in Redis's field names
+    static void cmd_info(Router& r, Args a, RespWriter& w) {
+        if (a.size() > 2) return w.error("syntax error");
+        std::string out;
+        const bool all = a.size() == 1 || iequals(a[1], "ALL") || iequals(a[1], "DEFAULT") || iequals(a[1], "EVERYTHING");
+        if (all || iequals(a[1], "PERSISTENCE")) {
+            Snapshot::Status s;
+            if (Snapshot* snap = r.snapshot()) s = snap->status();
+            else s.changes_since_save = r.store().changes();
+            auto field = [&](std::string_view name, const std::string& v) {
+                out.append(name).append(":").append(v).append("\r\n");
             };
-
-        h_["TYPE"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'type'");
-            const std::string& key = a[1];
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            switch (sh.type_of(key, now)) {
-            case ValueType::None:   return resp_bulk("none");
-            case ValueType::String: return resp_bulk("string");
-            case ValueType::Hash:   return resp_bulk("hash");
+            out += "# Persistence\r\n";
+            field("loading", "0");
+            field("rdb_changes_since_last_save", std::to_string(s.changes_since_save));
+            field("rdb_bgsave_in_progress", s.background_saving ? "1" : "0");
+            field("rdb_last_save_time", std::to_string(s.last_save));
+            field("rdb_last_bgsave_status", s.last_background_ok ? "ok" : "err");
+            field("rdb_last_bgsave_time_sec", std::to_string(s.last_background_seconds));
+            field("rdb_current_bgsave_time_sec", std::to_string(s.current_background_seconds));
+            field("rdb_last_cow_size", std::to_string(s.last_cow_bytes));
+            AppendLog* aof = r.append_log();
+            AppendLog::Status a;
+            if (aof) a = aof->status();
+            field("aof_enabled", aof ? "1" : "0");
+            field("aof_rewrite_in_progress", a.rewriting ? "1" : "0");
+            field("aof_last_rewrite_time_sec", std::to_string(a.last_rewrite_seconds));
+            field("aof_current_rewrite_time_sec", std::to_string(a.current_rewrite_seconds));
+            field("aof_last_bgrewrite_status", a.last_rewrite_ok ? "ok" : "err");
+            if (aof) {
+                field("aof_current_size", std::to_string(a.current_size));
+                field("aof_base_size", std::to_string(a.base_size));
             }
-            return resp_bulk("none");
-            };
+        }
+        w.bulk(out);
+    }
 
-        h_["MGET"] = [this](auto const& a) {
-            if (a.size() < 2) return resp_error("wrong #args for 'mget'");
-            auto now = std::chrono::steady_clock::now();
+    static void cmd_command(Router&, Args a, RespWriter& w);
+
+    // ---- command table -------------------------------------------------------
+
+    using F = CommandSpec::Flags;
+    using M = CommandSpec::Merge;
+
+    static constexpr CommandSpec kCommands[] = {
+        // name       arity  flags                 first last step  merge      per-key    handler      shared-read handler
+        { "PING",      -1, F::Fast,                   0,  0, 0,  M::None,   {},        cmd_ping },
+        { "ECHO",       2, F::Fast,                   0,  0, 0,  M::None,   {},        cmd_echo },
+        { "COMMAND",   -1, 0,                         0,  0, 0,  M::None,   {},        cmd_command },
+        { "GET",        2, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_get,     cmd_get_shared },
+        { "SET",       -3, F::Write | F::DenyOom,     1,  1, 1,  M::None,   {},        cmd_set },
+        { "DEL",       -2, F::Write,                  1, -1, 1,  M::Sum,    "DEL",     cmd_del },
+        { "EXISTS",    -2, F::ReadOnly | F::Fast,     1, -1, 1,  M::Sum,    "EXISTS",  cmd_exists },
+        { "MGET",      -2, F::ReadOnly | F::Fast,     1, -1, 1,  M::Array,  "GET",     cmd_mget },
+        { "MSET",      -3, F::Write | F::DenyOom,     1, -1, 2,  M::Ok,     "SET",     cmd_mset },
+        { "TTL",        2, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_ttl },
+        { "EXPIRE",     3, F::Write | F::Fast,        1,  1, 1,  M::None,   {},        cmd_expire },
+        { "PEXPIRE",    3, F::Write | F::Fast,        1,  1, 1,  M::None,   {},        cmd_pexpire },
+        { "PERSIST",    2, F::Write | F::Fast,        1,  1, 1,  M::None,   {},        cmd_persist },
+        { "EXPIREAT",   3, F::Write | F::Fast,        1,  1, 1,  M::None,   {},        cmd_expireat },
+        { "PEXPIREAT",  3, F::Write | F::Fast,        1,  1, 1,  M::None,   {},        cmd_pexpireat },
+        { "TYPE",       2, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_type },
+        { "HSET",      -4, F::Write | F::DenyOom | F::Fast, 1, 1, 1, M::None, {},      cmd_hset },
+        { "HGET",       3, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_hget,    cmd_hget_shared },
+        { "HDEL",      -3, F::Write | F::Fast,        1,  1, 1,  M::None,   {},        cmd_hdel },
+        { "HEXISTS",    3, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_hexists },
+        { "HLEN",       2, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_hlen },
+        { "HGETALL",    2, F::ReadOnly,               1,  1, 1,  M::None,   {},        cmd_hgetall },
+        { "HMGET",     -3, F::ReadOnly | F::Fast,     1,  1, 1,  M::None,   {},        cmd_hmget },
+        { "MEMORY",    -2, F::ReadOnly,               0,  0, 0,  M::None,   {},        cmd_memory },
+        { "SAVE",       1, 0,                         0,  0, 0,  M::None,   {},        cmd_save },
+        { "BGSAVE",     1, 0,                         0,  0, 0,  M::None,   {},        cmd_bgsave },
+        { "BGREWRITEAOF", 1, 0,                       0,  0, 0,  M::None,   {},        cmd_bgrewriteaof },
+        { "LASTSAVE",   1, F::Fast,                   0,  0, 0,  M::None,   {},        cmd_lastsave },
+        { "INFO",      -1, F::ReadOnly,               0,  0, 0,  M::None,   {},        cmd_info },
+    };
+    static constexpr size_t kCommandCount = sizeof(kCommands) / sizeof(kCommands[0]);
+
+    // Perfect hash over the (case-folded) names: a seed is searched at compile time
+    // so that every command lands in its own slot, making lookup one hash, one slot
+    // read and one compare, with no allocation.
+    static constexpr size_t kSlots = 128;
+    static_assert(kCommandCount < kSlots);
+
+    static constexpr std::uint32_t name_hash(std::string_view s, std::uint32_t seed) {
+        std::uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(ascii_upper(c));
+            h *= 16777619u;
+        }
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        return h;
+    }
 
-            // type check first
-            for (size_t i = 1; i < a.size(); ++i) {
-                auto& sh = store_.shard_for(a[i]);
-                auto t = sh.type_of(a[i], now);
-                if (t == ValueType::Hash) return resp_wrongtype(); // <-- std::string
+    static constexpr std::uint32_t find_seed() {
+        for (std::uint32_t seed = 0; seed < 100000; ++seed) {
+            bool used[kSlots] = {};
+            bool ok = true;
+            for (auto& c : kCommands) {
+                auto slot = name_hash(c.name, seed) % kSlots;
+                if (used[slot]) { ok = false; break; }
+                used[slot] = true;
             }
+            if (ok) return seed;
+        }
+        return UINT32_MAX;
+    }
 
-            std::ostringstream arr;
-            arr << "*" << (a.size() - 1) << "\r\n";
-            for (size_t i = 1; i < a.size(); ++i) {
-                auto& sh = store_.shard_for(a[i]);
-                auto v = sh.get(a[i]);
-                if (!v) { arr << "$-1\r\n"; }
-                else { arr << "$" << v->size() << "\r\n" << *v << "\r\n"; }
-            }
-            return arr.str(); // std::string
-            };
+    static constexpr std::uint32_t kSeed = find_seed();
+    static_assert(kSeed != UINT32_MAX, "no perfect hash seed for the command table");
+
+    // slot -> 1 + index into kCommands (0 = empty)
+    static constexpr auto kSlotTable = [] {
+        std::array<std::uint8_t, kSlots> t{};
+        for (size_t i = 0; i < kCommandCount; ++i) {
+            t[name_hash(kCommands[i].name, kSeed) % kSlots] = static_cast<std::uint8_t>(i + 1);
+        }
+        return t;
+    }();
+
+    const CommandSpec* Router::lookup(std::string_view name) {
+        auto e = kSlotTable[name_hash(name, kSeed) % kSlots];
+        if (e == 0) return nullptr;
+        const CommandSpec& c = kCommands[e - 1];
+        return iequals(name, c.name) ? &c : nullptr;
+    }
 
+    std::span<const CommandSpec> Router::commands() {
+        return { kCommands, kCommandCount };
+    }
 
-        h_["HMGET"] = [this](auto const& a) {
-            if (a.size() < 3) return resp_error("wrong #args for 'hmget'");
-            const std::string& key = a[1];
-            auto& sh = store_.shard_for(key);
-            auto now = std::chrono::steady_clock::now();
-            auto t = sh.type_of(key, now);
-            if (t == ValueType::String) return resp_wrongtype(); // <-- std::string
+    static bool arity_ok(const CommandSpec& c, size_t argc) {
+        return c.arity >= 0 ? argc == static_cast<size_t>(c.arity) : argc >= static_cast<size_t>(-c.arity);
+    }
+
+    static void append_lower(std::string& out, std::string_view s) {
+        for (char ch : s) out.push_back(ascii_lower(ch));
+    }
+
+    // COMMAND INFO entry: [name, arity, [flags...], first key, last key, step]
+    static void write_command_info(const CommandSpec& c, RespWriter& w) {
+        w.array(6);
+        w.raw("$");
+        w.raw(std::to_string(c.name.size()));
+        w.raw("\r\n");
+        append_lower(w.buffer(), c.name);
+        w.raw("\r\n");
+        w.integer(c.arity);
+        int nflags = !!(c.flags & F::Write) + !!(c.flags & F::ReadOnly) + !!(c.flags & F::DenyOom) + !!(c.flags & F::Fast);
+        w.array(static_cast<size_t>(nflags));
+        if (c.flags & F::Write) w.simple("write");
+        if (c.flags & F::ReadOnly) w.simple("readonly");
+        if (c.flags & F::DenyOom) w.simple("denyoom");
+        if (c.flags & F::Fast) w.simple("fast");
+        w.integer(c.first_key);
+        w.integer(c.last_key);
+        w.integer(c.step);
+    }
 
-            std::ostringstream arr;
-            arr << "*" << (a.size() - 2) << "\r\n";
+    // COMMAND | COMMAND COUNT | COMMAND INFO name [name ...]
+    static void cmd_command(Router&, Args a, RespWriter& w) {
+        if (a.size() == 1) {
+            w.array(kCommandCount);
+            for (auto& c : kCommands) write_command_info(c, w);
+            return;
+        }
+        if (iequals(a[1], "COUNT")) return w.integer(static_cast<long long>(kCommandCount));
+        if (iequals(a[1], "INFO")) {
+            w.array(a.size() - 2);
             for (size_t i = 2; i < a.size(); ++i) {
-                auto v = sh.hget(key, a[i]);
-                if (!v) { arr << "$-1\r\n"; }
-                else { arr << "$" << v->size() << "\r\n" << *v << "\r\n"; }
+                const CommandSpec* c = Router::lookup(a[i]);
+                if (c) write_command_info(*c, w);
+                else w.nil();
             }
-            return arr.str();
-            };
-
+            return;
+        }
+        return w.error("unknown subcommand for 'command'");
+    }
 
-        h_["MSET"] = [this](auto const& a) {
-            if ((a.size() < 3) || ((a.size() - 1) % 2 != 0)) return resp_error("wrong #args for 'mset'");
-            for (size_t i = 1; i + 1 < a.size(); i += 2) {
-                const std::string& key = a[i];
-                const std::string& val = a[i + 1];
-                store_.shard_for(key).set(key, val);
+    // ---- cross-shard merge ---------------------------------------------------
+
+    static void merge_replies(CommandSpec::Merge merge, std::vector<Reply>& parts, RespWriter& w) {
+        for (auto& p : parts) {
+            if (!p.text.empty() && p.text[0] == '-') return w.raw(p.text);     // any failed key fails the command
+        }
+        switch (merge) {
+        case M::Ok:
+            return w.ok();
+        case M::Sum: {
+            long long n = 0;
+            for (auto& p : parts) {
+                long long v = 0;
+                to_ll(std::string_view(p.text).substr(1, p.text.size() - 3), v);  // ":n\r\n"
+                n += v;
             }
-            return resp_simple("OK");
-            };
+            return w.integer(n);
+        }
+        case M::Array:
+        case M::None:
+            // every part is already a bulk or nil reply
+            w.array(parts.size());
+            for (auto& p : parts) w.append(std::move(p));
+            return;
+        }
+    }
+
+    // ---- Router --------------------------------------------------------------
+
+    Router::Router(Store& s, ShardPool& pool, Snapshot* snapshot, AppendLog* aof)
+        : store_(s), pool_(pool), snapshot_(snapshot), aof_(aof) {}
+
+    // appendfsync always: a write is acknowledged only once its log record is on
+    // disk, so then (which hands the reply on) runs from the log's writer thread if
+    // the shard logged anything since before; otherwise it runs now.
+    template <class F>
+    static void when_logged(AppendLog* aof, size_t shard, uint64_t before, F&& then) {
+        if (aof && aof->policy() == Fsync::Always && aof->appended(shard) != before) {
+            aof->when_durable(shard, std::forward<F>(then));
+            return;
+        }
+        then();
+    }
 
+    // Runs a handler; an exception replaces whatever it had written with an error.
+    // A shared-read handler's false is passed on; otherwise the command is served.
+    template <class Fn>
+    static bool invoke(Fn fn, Router& r, Args args, RespWriter& w) {
+        const std::size_t mark = w.size();
+        try {
+            if constexpr (std::is_same_v<Fn, CommandSpec::SharedFn>) return fn(r, args, w);
+            else fn(r, args, w);
+        }
+        catch (const std::exception& e) {
+            w.rewind(mark);
+            w.error(std::string("server error: ") + e.what());
+        }
+        catch (...) {
+            w.rewind(mark);
+            w.error("server error");
+        }
+        return true;
+    }
+
+    void Router::dispatch(Args args, RespWriter& w) {
+        if (args.empty()) return w.error("empty");
+        const CommandSpec* c = lookup(args[0]);
+        if (!c) return w.error("unknown command");
+        if (!arity_ok(*c, args.size())) {
+            w.raw("-ERR wrong #args for '");
+            append_lower(w.buffer(), c->name);
+            return w.raw("'\r\n");
+        }
+        invoke(c->fn, *this, args, w);
+    }
+
+    void Router::dispatch(Args args, Reply& out) {
+        RespWriter w(out);
+        dispatch(args, w);
+    }
+
+    std::string Router::dispatch(Args args) {
+        std::string out;
+        RespWriter w(out);
+        dispatch(args, w);
+        return out;
     }
 
     std::string Router::dispatch(const std::vector<std::string>& args) {
-        if (args.empty()) return resp_error("empty");
-        auto cmd = upper(args[0]);
-        auto it = h_.find(cmd);
-        if (it == h_.end()) return resp_error("unknown command");
-        return it->second(args);
+        std::vector<std::string_view> views(args.begin(), args.end());
+        return dispatch(Args(views));
+    }
+
+    void Router::execute(std::vector<std::string_view> args, Reply out, Completion done, bool idle) {
+        const CommandSpec* c = args.empty() ? nullptr : lookup(args[0]);
+        // Unknown, malformed or key-less: dispatch touches no shard data, run inline.
+        if (!c || !arity_ok(*c, args.size()) || c->first_key == 0) {
+            dispatch(Args(args), out);
+            done(std::move(out));
+            return;
+        }
+        // Shared-read mode: reads go straight to the shard's published keyspace, unless
+        // an earlier command of the caller (maybe a write to this key) is still queued.
+        EpochDomain* shared = store_.shared_reads();
+        if (idle && c->shared_fn && shared && shared->reader_ready()) {
+            RespWriter w(out);
+            if (invoke(c->shared_fn, *this, Args(args), w)) {
+                done(std::move(out));
+                return;
+            }
+        }
+        if (c->merge != CommandSpec::Merge::None) {
+            fan_out(*c, std::move(args), std::move(out), std::move(done));
+            return;
+        }
+        size_t owner = store_.shard_index(args[static_cast<size_t>(c->first_key)]);
+        pool_.post(owner, [this, owner, args = std::move(args), out = std::move(out), done = std::move(done)]() mutable {
+            const uint64_t logged = aof_ ? aof_->appended(owner) : 0;
+            dispatch(Args(args), out);
+            when_logged(aof_, owner, logged, [out = std::move(out), done = std::move(done)]() mutable { done(std::move(out)); });
+            });
+    }
+
+    void Router::fan_out(const CommandSpec& c, std::vector<std::string_view> args, Reply out, Completion done) {
+        const size_t first = static_cast<size_t>(c.first_key);
+        const size_t step = static_cast<size_t>(c.step);
+        const size_t end = c.last_key < 0 ? args.size() + 1 - static_cast<size_t>(-c.last_key)
+                                          : static_cast<size_t>(c.last_key) + 1;
+        if ((args.size() - first) % step != 0) {            // keys without their values
+            dispatch(Args(args), out);
+            done(std::move(out));
+            return;
+        }
+
+        // key positions grouped by owning shard
+        std::vector<std::vector<size_t>> by_shard(store_.shard_count());
+        for (size_t i = first; i < end; i += step) {
+            by_shard[store_.shard_index(args[i])].push_back(i);
+        }
+        size_t involved = 0, last = 0;
+        for (size_t s = 0; s < by_shard.size(); ++s) {
+            if (!by_shard[s].empty()) { ++involved; last = s; }
+        }
+        if (involved == 1) {
+            // all keys live on one shard: run the command as-is there
+            pool_.post(last, [this, last, args = std::move(args), out = std::move(out), done = std::move(done)]() mutable {
+                const uint64_t logged = aof_ ? aof_->appended(last) : 0;
+                dispatch(Args(args), out);
+                when_logged(aof_, last, logged, [out = std::move(out), done = std::move(done)]() mutable { done(std::move(out)); });
+                });
+            return;
+        }
+
+        // Otherwise each key (with the step-1 arguments after it) becomes one
+        // per-key command on its shard, and the replies are merged in key order.
+        struct Gather {
+            const CommandSpec* cmd;
+            std::vector<std::string_view> args;
+            std::vector<std::vector<size_t>> by_shard;
+            std::vector<Reply> parts;           // one reply per key, in argument order
+            std::atomic<size_t> left{ 0 };
+            Reply out;
+            Completion done;
+        };
+        auto g = std::make_shared<Gather>();
+        g->cmd = &c;
+        g->parts.resize((args.size() - first) / step);
+        g->args = std::move(args);
+        g->by_shard = std::move(by_shard);
+        g->left = involved;
+        g->out = std::move(out);
+        g->done = std::move(done);
+
+        // Each shard gets one task, posted now, so that a command the same client
+        // sends next lands behind it there. A command that may add data has the
+        // shard make room first: a shard that cannot writes none of its keys and
+        // fails the command with -OOM, though the other shards still write theirs.
+        for (size_t s = 0; s < g->by_shard.size(); ++s) {
+            if (g->by_shard[s].empty()) continue;
+            pool_.post(s, [this, s, g, first, step] {
+                const uint64_t logged = aof_ ? aof_->appended(s) : 0;
+                if ((g->cmd->flags & F::DenyOom) && !store_.shard_by_index(s).make_room(ttl::coarse_now())) {
+                    for (size_t i : g->by_shard[s]) RespWriter(g->parts[(i - first) / step]).raw(reply::oom);
+                }
+                else {
+                    std::string_view sub[3] = { g->cmd->per_key };
+                    for (size_t i : g->by_shard[s]) {
+                        for (size_t j = 0; j < step; ++j) sub[j + 1] = g->args[i + j];
+                        dispatch(Args(sub, step + 1), g->parts[(i - first) / step]);
+                    }
+                }
+                when_logged(aof_, s, logged, [g] {
+                    if (g->left.fetch_sub(1) == 1) {
+                        RespWriter w(g->out);
+                        merge_replies(g->cmd->merge, g->parts, w);
+                        g->done(std::move(g->out));
+                    }
+                });
+                });
+        }
     }
 
 } // namespace redisx
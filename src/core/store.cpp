@@ -1,201 +1,298 @@
 #include <redisx/core/store.hpp>
+#include <algorithm>
 #include <functional>
 #include <memory>
 
 namespace redisx {
 
+    Entry* Shard::find_live(std::string_view k, TimePoint now) {
+        Entry* e = keys_.find(k);
+        if (!e) return nullptr;
+        if (due(*e, now)) {
+            remove(e);
+            dropped(k);
+            return nullptr;
+        }
+        touch(*e, now);
+        return e;
+    }
+
+    // Entry::expires and expiry_ must always agree; every deadline change goes here.
+    void Shard::set_deadline(Entry* e, TimePoint tp) {
+        if (tp != Entry::kNoExpiry) expiry_.set(e->key, tp);
+        else if (e->has_expiry()) expiry_.clear(e->key);
+        e->set_expires(tp);
+    }
+
+    void Shard::remove(Entry* e) {
+        if (e->has_expiry()) expiry_.clear(e->key);
+        keys_.erase(e);
+    }
+
     // KV
 
-    std::optional<std::string> Shard::get(const std::string& k) {
-        auto now = std::chrono::steady_clock::now();
-        std::unique_lock lk(mu_);
-        if (is_expired_unlocked(k, now)) {
-            map_.erase(k);
-            ttl_.erase(k);
-            hmap_.erase(k); // if key used as hash, expire it too
-            return std::nullopt;
+    void Shard::set(std::string_view k, std::string_view v) {
+        auto now = ttl::coarse_now();
+        Value val = string_value(v, arena_);
+        auto [e, inserted] = keys_.emplace(k, std::move(val));
+        changed();
+        if (inserted) return track_new(e, now);
+        if (due(*e, now)) {
+            dropped(k);                 // it expired before being overwritten
+            set_deadline(e, Entry::kNoExpiry);
         }
-        auto it = map_.find(k);
-        if (it == map_.end()) return std::nullopt;
-        return it->second;
+        touch(*e, now);
+        keys_.assign(e, std::move(val));
     }
 
-    void Shard::set(const std::string& k, std::string v) {
-        auto now = std::chrono::steady_clock::now();
-        std::unique_lock lk(mu_);
-        if (is_expired_unlocked(k, now)) {
-            ttl_.erase(k);
-            hmap_.erase(k);
-        }
-        map_[k] = std::move(v);
-        hmap_.erase(k);
+    bool Shard::del(std::string_view k) {
+        Entry* e = keys_.find(k);
+        if (!e) return false;
+        remove(e);
+        changed();
+        return true;
     }
 
-    bool Shard::del(const std::string& k) {
-        std::unique_lock lk(mu_);
-        ttl_.erase(k);
-        bool s = map_.erase(k) > 0;
-        bool h = hmap_.erase(k) > 0;
-        return s || h;
+    OpStatus Shard::get_string_checked(std::string_view key, TimePoint now, const Entry*& out) {
+        Entry* e = find_live(key, now);
+        if (!e) return OpStatus::NotFound;
+        if (!e->str()) return OpStatus::WrongType;
+        out = e;
+        return OpStatus::Ok;
     }
 
     // TTL
 
-    void Shard::set_expire(const std::string& k, std::chrono::steady_clock::time_point tp) {
-        std::unique_lock lk(mu_);
-        // only set TTL if key exists (string or hash)
-        if (map_.find(k) != map_.end() || hmap_.find(k) != hmap_.end()) {
-            ttl_[k] = tp;
-        }
+    // A deadline no later than the now it was computed from takes the key at once:
+    // lookups compare against the coarse clock, which may not have reached it yet.
+    void Shard::expire_at(Entry* e, std::string_view k, TimePoint tp, TimePoint now) {
+        if (tp > now) return set_deadline(e, tp);
+        remove(e);
+        dropped(k);
     }
 
-    long long Shard::ttl_ms(const std::string& k, std::chrono::steady_clock::time_point now) {
-        std::shared_lock lk(mu_);
-        bool exists = (map_.find(k) != map_.end()) || (hmap_.find(k) != hmap_.end());
-        if (!exists) return -2;
-        auto it = ttl_.find(k);
-        if (it == ttl_.end()) return -1;
-        auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(it->second - now).count();
-        if (remain <= 0) return -2;
-        return remain;
+    void Shard::set_expire(std::string_view k, TimePoint tp, TimePoint now) {
+        // only set TTL if key exists (string or hash); not a change of its own, as
+        // it follows the set() of SET ... EX
+        if (Entry* e = keys_.find(k)) expire_at(e, k, tp, now);
     }
 
-    void Shard::clear_expire(const std::string& k) {
-        std::unique_lock lk(mu_);
-        ttl_.erase(k);
+    bool Shard::expire_if_exists(std::string_view key, TimePoint tp, TimePoint now) {
+        Entry* e = find_live(key, now);
+        if (!e) return false;
+        expire_at(e, key, tp, now);
+        changed();
+        return true;
     }
 
-    bool Shard::is_expired_unlocked(const std::string& k, std::chrono::steady_clock::time_point now) const {
-        auto it = ttl_.find(k);
-        if (it == ttl_.end()) return false;
-        return now >= it->second;
+    bool Shard::persist_if_exists(std::string_view key, TimePoint now) {
+        Entry* e = find_live(key, now);
+        if (!e) return false;
+        if (e->has_expiry()) changed();
+        set_deadline(e, Entry::kNoExpiry);
+        return true;
     }
 
-    void Shard::sweep(std::chrono::steady_clock::time_point now) {
-        std::unique_lock lk(mu_);
-        std::vector<std::string> to_erase;
-        to_erase.reserve(ttl_.size());
-        for (auto& [key, tp] : ttl_) {
-            if (now >= tp) to_erase.push_back(key);
+    long long Shard::ttl_ms(std::string_view k, TimePoint now) {
+        Entry* e = keys_.find(k);
+        if (!e) return -2;
+        if (!e->has_expiry()) return -1;
+        auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(e->expires - now).count();
+        if (remain <= 0) return -2;
+        return remain;
+    }
+
+    void Shard::clear_expire(std::string_view k) {
+        if (Entry* e = keys_.find(k); e && e->has_expiry()) {
+            set_deadline(e, Entry::kNoExpiry);
+            changed();
+        }
+    }
+
+    // Only keys that are due are visited; the index has already dropped them. The
+    // clock is read once per batch, which costs about as much as expiring a key.
+    bool Shard::sweep(TimePoint now, std::chrono::steady_clock::duration budget) {
+        constexpr size_t kBatch = 32;
+        keys_.reclaim();
+        const auto stop = std::chrono::steady_clock::now() + budget;
+        auto expire = [&](const std::string& k) {
+            Entry* e = keys_.find(k);
+            if (e && now >= e->expires) {
+                keys_.erase(e);
+                dropped(k);
+            }
+        };
+        while (expiry_.sweep_due(now, expire, kBatch) == kBatch) {
+            if (std::chrono::steady_clock::now() >= stop) return true;
         }
-        for (auto& k : to_erase) {
-            map_.erase(k);
-            hmap_.erase(k);
-            ttl_.erase(k);
+        // the rest of the budget moves an unfinished rehash along
+        constexpr size_t kRehashBatch = 1024;
+        while (keys_.rehash(kRehashBatch)) {
+            if (std::chrono::steady_clock::now() >= stop) return true;
         }
+        return false;
     }
 
     // Hashes
 
-    // Make hset NOT try to overwrite a string, router will enforce WRONGTYPE before calling.
-    int Shard::hset(const std::string& key, const std::string& field, const std::string& value) {
-        auto now = std::chrono::steady_clock::now();
-        std::unique_lock lk(mu_);
-        if (is_expired_unlocked(key, now)) {
-            ttl_.erase(key);
-            map_.erase(key);
-            hmap_.erase(key);
+    OpStatus Shard::hget_checked(std::string_view key, std::string_view field, TimePoint now, std::string_view& out) {
+        const HashValue* h = nullptr;
+        OpStatus st = hash_checked(key, now, h);
+        if (st != OpStatus::Ok) return st;
+        auto v = h->find(field);
+        if (!v) return OpStatus::NotFound;
+        out = *v;
+        return OpStatus::Ok;
+    }
+
+    OpStatus Shard::hash_checked(std::string_view key, TimePoint now, const HashValue*& out) {
+        Entry* e = find_live(key, now);
+        if (!e) return OpStatus::NotFound;
+        out = e->hash();
+        return out ? OpStatus::Ok : OpStatus::WrongType;
+    }
+
+    OpStatus Shard::hset_checked(std::string_view key, std::span<const std::string_view> field_values, TimePoint now, long long& added) {
+        Entry* e = find_live(key, now);
+        if (e && !e->hash()) return OpStatus::WrongType;
+        // Shared readers may be in a packed hash: change a copy and publish that. A
+        // converted one is changed in place, as readers leave those to this thread,
+        // so a write never copies more than a packed hash's few fields.
+        SlabPtr<HashValue> copy;
+        if (keys_.shared() && (!e || e->hash()->packed())) copy = hash_value(arena_, e ? e->hash() : nullptr);
+        else if (!e) track_new(e = keys_.emplace(key, hash_value(arena_)).first, now);
+        HashValue& hm = copy ? *copy : *e->hash();
+        added = 0;
+        for (size_t i = 0; i + 1 < field_values.size(); i += 2) {
+            if (hm.set(field_values[i], field_values[i + 1], hash_limits_)) ++added;
         }
-        auto& hm = hmap_[key];
-        auto it = hm.find(field);
-        if (it == hm.end()) { hm.emplace(field, value); return 1; }
-        it->second = value; return 0;
-    }
-
-    std::optional<std::string> Shard::hget(const std::string& key, const std::string& field) {
-        auto now = std::chrono::steady_clock::now();
-        std::shared_lock lk(mu_);
-        if (is_expired_unlocked(key, now)) return std::nullopt;
-        auto kh = hmap_.find(key);
-        if (kh == hmap_.end()) return std::nullopt;
-        auto it = kh->second.find(field);
-        if (it == kh->second.end()) return std::nullopt;
-        return it->second;
-    }
-
-    int Shard::hdel(const std::string& key, const std::string& field) {
-        auto now = std::chrono::steady_clock::now();
-        std::unique_lock lk(mu_);
-        if (is_expired_unlocked(key, now)) {
-            ttl_.erase(key);
-            map_.erase(key);
-            hmap_.erase(key);
-            return 0;
+        changed(field_values.size() / 2);
+        if (copy) {
+            if (e) keys_.assign(e, std::move(copy));
+            else track_new(keys_.emplace(key, std::move(copy)).first, now);
         }
-        auto kh = hmap_.find(key);
-        if (kh == hmap_.end()) return 0;
-        int removed = (int)(kh->second.erase(field) > 0);
-        if (kh->second.empty()) {
-            hmap_.erase(kh);
+        return OpStatus::Ok;
+    }
+
+    OpStatus Shard::hdel_checked(std::string_view key, std::span<const std::string_view> fields, TimePoint now, long long& removed) {
+        removed = 0;
+        Entry* e = find_live(key, now);
+        if (!e) return OpStatus::NotFound;
+        HashValue* hm = e->hash();
+        if (!hm) return OpStatus::WrongType;
+        SlabPtr<HashValue> copy;            // as in hset_checked
+        if (keys_.shared() && hm->packed()) {
+            copy = hash_value(arena_, hm);
+            hm = copy.get();
+        }
+        for (auto field : fields) {
+            if (hm->erase(field)) ++removed;
         }
-        return removed;
-    }
-
-    int Shard::hexists(const std::string& key, const std::string& field) {
-        auto now = std::chrono::steady_clock::now();
-        std::shared_lock lk(mu_);
-        if (is_expired_unlocked(key, now)) return 0;
-        auto kh = hmap_.find(key);
-        if (kh == hmap_.end()) return 0;
-        return kh->second.count(field) ? 1 : 0;
-    }
-
-    long long Shard::hlen(const std::string& key) {
-        auto now = std::chrono::steady_clock::now();
-        std::shared_lock lk(mu_);
-        if (is_expired_unlocked(key, now)) return 0;
-        auto kh = hmap_.find(key);
-        if (kh == hmap_.end()) return 0;
-        return static_cast<long long>(kh->second.size());
-    }
-
-    std::vector<std::string> Shard::hgetall(const std::string& key) {
-        auto now = std::chrono::steady_clock::now();
-        std::shared_lock lk(mu_);
-        std::vector<std::string> out;
-        if (is_expired_unlocked(key, now)) return out;
-        auto kh = hmap_.find(key);
-        if (kh == hmap_.end()) return out;
-        out.reserve(kh->second.size() * 2);
-        for (auto& [f, v] : kh->second) {
-            out.push_back(f);
-            out.push_back(v);
+        changed(static_cast<uint64_t>(removed));
+        if (hm->empty()) remove(e);
+        else if (copy && removed) keys_.assign(e, std::move(copy));
+        return OpStatus::Ok;
+    }
+
+    // Snapshots
+
+    void Shard::restore(std::string_view key, std::string_view value, TimePoint deadline, TimePoint now) {
+        Value v = string_value(value, arena_);
+        auto [e, inserted] = keys_.emplace(key, std::move(v));
+        if (!inserted) e = keys_.assign(e, std::move(v));
+        track_new(e, now);
+        set_deadline(e, deadline);
+    }
+
+    void Shard::restore(std::string_view key, std::span<const std::string_view> field_values, TimePoint deadline, TimePoint now) {
+        SlabPtr<HashValue> h = hash_value(arena_);
+        for (size_t i = 0; i + 1 < field_values.size(); i += 2) h->set(field_values[i], field_values[i + 1], hash_limits_);
+        Value v = std::move(h);
+        auto [e, inserted] = keys_.emplace(key, std::move(v));
+        if (!inserted) e = keys_.assign(e, std::move(v));
+        track_new(e, now);
+        set_deadline(e, deadline);
+    }
+
+    // Memory
+
+    size_t Shard::used_memory() const {
+        auto m = arena_.stats();
+        return m.used + m.external;
+    }
+
+    void Shard::set_maxmemory(size_t bytes, EvictPolicy policy) {
+        maxmemory_ = bytes;
+        evictor_ = Evictor(policy);
+    }
+
+    // In shared mode an evicted entry is only retired, and stays allocated while a
+    // reader is still in the epoch it was retired in. Evictions that free nothing
+    // are counted, and after a pool's worth of them the write fails instead of
+    // going on until one pinned reader has had the shard emptied.
+    bool Shard::make_room(TimePoint now) {
+        if (loading_ || maxmemory_ == 0 || used_memory() <= maxmemory_) return true;
+        size_t held = 0;
+        for (size_t used = used_memory(); used > maxmemory_;) {
+            if (held == Evictor::kPoolSize) return false;
+            Entry* e = evictor_.next_victim(keys_, now);
+            if (!e) return false;
+            dropped(e->key);
+            remove(e);
+            keys_.reclaim();
+            evicted_.store(evicted_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            changed();
+            const size_t after = used_memory();
+            if (after >= used) ++held;
+            used = after;
         }
-        return out;
+        return true;
     }
 
     // Store
 
-    Store::Store(size_t n) {
+    Store::Store(size_t n, ttl::Engine expiry, bool shared_reads) {
         if (n == 0) n = 1;
+        if (shared_reads) domain_ = std::make_unique<EpochDomain>();
         shards_.reserve(n);
         for (size_t i = 0; i < n; ++i) {
-            shards_.push_back(std::make_unique<Shard>());
+            shards_.push_back(std::make_unique<Shard>(expiry, domain_.get()));
         }
     }
 
-    Shard& Store::shard_for(const std::string& key) {
-        size_t h = std::hash<std::string>{}(key);
-        return *shards_[h % shards_.size()];
+    void Store::set_maxmemory(size_t bytes, EvictPolicy policy) {
+        const size_t per_shard = bytes == 0 ? 0 : std::max<size_t>(1, bytes / shards_.size());
+        for (auto& s : shards_) s->set_maxmemory(per_shard, policy);
     }
 
-    void Store::sweep_all() {
-        auto now = std::chrono::steady_clock::now();
-        for (auto& s : shards_) s->sweep(now);
+    void Store::set_hash_limits(const HashLimits& limits) {
+        for (auto& s : shards_) s->set_hash_limits(limits);
     }
 
-    ValueType Shard::type_of(const std::string& key, std::chrono::steady_clock::time_point now) {
-        std::unique_lock lk(mu_);
-        if (is_expired_unlocked(key, now)) {
-            // lazy expire: clear any data for this key
-            map_.erase(key);
-            hmap_.erase(key);
-            ttl_.erase(key);
-            return ValueType::None;
+    uint64_t Store::changes() const {
+        uint64_t n = 0;
+        for (auto& s : shards_) n += s->changes();
+        return n;
+    }
+
+    void Store::on_drop(std::function<void(size_t shard, std::string_view key)> f) {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i]->on_drop([f, i](std::string_view key) { f(i, key); });
         }
-        if (map_.find(key) != map_.end())  return ValueType::String;
-        if (hmap_.find(key) != hmap_.end()) return ValueType::Hash;
-        return ValueType::None;
+    }
+
+    void Store::set_loading(bool on) {
+        for (auto& s : shards_) s->set_loading(on);
+    }
+
+    size_t Store::shard_index(std::string_view key) const {
+        size_t h = std::hash<std::string_view>{}(key);
+        return h % shards_.size();
+    }
+
+    ValueType Shard::type_of(std::string_view key, TimePoint now) {
+        Entry* e = find_live(key, now);     // lazy expire: drops the key if due
+        return e ? e->type() : ValueType::None;
     }
 
 } // namespace redisx
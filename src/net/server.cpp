@@ -4,21 +4,60 @@ using asio::ip::tcp;
 
 namespace redisx {
 
-    Server::Server(asio::io_context& io, uint16_t port, Router& router, ThreadPool& pool)
-        : acceptor_(io, tcp::endpoint(tcp::v4(), port))
-        , router_(router)
-        , pool_(pool) {
+#if defined(SO_REUSEPORT)
+    // SO_REUSEPORT in the shape of Asio's SettableSocketOption, which has no
+    // public option of its own for it
+    class ReusePort {
+    public:
+        explicit ReusePort(bool on) : value_(on ? 1 : 0) {}
+        template <class Protocol> int level(const Protocol&) const { return SOL_SOCKET; }
+        template <class Protocol> int name(const Protocol&) const { return SO_REUSEPORT; }
+        template <class Protocol> const int* data(const Protocol&) const { return &value_; }
+        template <class Protocol> std::size_t size(const Protocol&) const { return sizeof(value_); }
+
+    private:
+        int value_;
+    };
+#endif
+
+    bool Server::reuse_port_supported() {
+#if defined(SO_REUSEPORT)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    Server::Server(asio::io_context& io, uint16_t port, Router& router, bool reuse_port)
+        : acceptor_(io)
+        , router_(router) {
+        tcp::endpoint ep(tcp::v4(), port);
+        acceptor_.open(ep.protocol());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+        if (reuse_port) acceptor_.set_option(ReusePort(true));
+#else
+        (void)reuse_port;
+#endif
+        acceptor_.bind(ep);
+        acceptor_.listen();
         accept();
     }
 
     void Server::accept() {
-        acceptor_.async_accept([this](std::error_code ec, tcp::socket socket) {
+        auto on_accept = [this](std::error_code ec, tcp::socket socket) {
             if (!ec) {
-                std::make_shared<Session>(std::move(socket), router_, pool_)->start();
+                std::make_shared<Session>(std::move(socket), router_)->start();
             }
             accept();
-            });
+            };
+        if (targets_.empty()) {
+            acceptor_.async_accept(on_accept);
+        }
+        else {
+            asio::io_context& ctx = *targets_[next_++ % targets_.size()];
+            acceptor_.async_accept(ctx, on_accept);
+        }
     }
 
 } // namespace redisx
-
@@ -1,78 +1,261 @@
 #include <redisx/net/session.hpp>
 #include <asio/bind_executor.hpp>
 #include <asio/write.hpp>
+#include <algorithm>
+#include <cstring>
 
 using asio::ip::tcp;
 
 namespace redisx {
 
-    Session::Session(tcp::socket sock, Router& router, ThreadPool& pool)
+    // Per-write batch caps: stay well under IOV_MAX and avoid pinning huge replies
+    // behind one syscall.
+    static constexpr std::size_t kMaxWriteBuffers = 64;
+    static constexpr std::size_t kMaxWriteBytes = 256 * 1024;
+
+    // Input chunking: default chunk size, smallest read worth issuing into the
+    // current chunk, and how many idle chunks a session keeps for reuse.
+    static constexpr std::size_t kChunkSize = 16 * 1024;
+    static constexpr std::size_t kMinRead = 1024;
+    static constexpr std::size_t kMaxSpare = 2;
+    // Bulks this large bypass the chunks and are read into their own buffer.
+    static constexpr std::size_t kLargeBulk = 32 * 1024;
+
+    // Backpressure: a session stops reading while this many frames are in flight,
+    // or this many reply bytes are queued for a client that does not read them.
+    static constexpr std::uint64_t kMaxInFlight = 4096;
+    static constexpr std::size_t kMaxQueuedBytes = 4 * 1024 * 1024;
+
+    // Reply buffer recycling: how many a session keeps, and the largest capacity
+    // worth keeping (one huge reply should not pin its memory for the session).
+    static constexpr std::size_t kMaxFreeBufs = 64;
+    static constexpr std::size_t kMaxFreeBufCapacity = 64 * 1024;
+
+    Session::Session(tcp::socket sock, Router& router)
         : socket_(std::move(sock))
         , ex_(socket_.get_executor())
         , strand_(ex_)
-        , router_(router)
-        , pool_(pool) {
-        inbuf_.resize(8 * 1024);
+        , parser_(kLargeBulk)
+        , router_(router) {
+        in_ = std::make_shared<Chunk>();
+        in_->buf.resize(kChunkSize);
     }
 
     void Session::start() { do_read(); }
 
+    void Session::make_room() {
+        Chunk& c = *in_;
+        if (c.parsed == c.filled && in_.use_count() == 1 && !parser_.in_frame()) {
+            c.parsed = c.filled = 0;                        // fully consumed and idle: rewind
+        }
+        if (c.buf.size() - c.filled >= kMinRead) return;
+
+        // Move the partial frame at the tail into a fresh chunk; frames still in
+        // flight keep this one alive until their replies come back.
+        std::size_t tail = c.filled - c.parsed;
+        std::size_t want = std::max(kChunkSize, tail * 2);
+        ChunkPtr next;
+        for (auto it = spare_.begin(); it != spare_.end(); ++it) {
+            if (it->use_count() == 1 && (*it)->buf.size() >= want) {
+                next = std::move(*it);
+                spare_.erase(it);
+                break;
+            }
+        }
+        if (!next) {
+            next = std::make_shared<Chunk>();
+            next->buf.resize(want);
+        }
+        std::memcpy(next->buf.data(), c.buf.data() + c.parsed, tail);
+        next->filled = tail;
+        next->parsed = 0;
+        if (parser_.in_frame()) held_.push_back(in_);    // earlier args of this frame point into it
+        if (c.buf.size() == kChunkSize && spare_.size() < kMaxSpare) spare_.push_back(in_);
+        in_ = std::move(next);
+    }
+
     void Session::do_read() {
         auto self = shared_from_this();
-        socket_.async_read_some(asio::buffer(inbuf_),
-            [this, self](std::error_code ec, std::size_t n) {
+        asio::mutable_buffer dst;
+        if (bulk_) {
+            dst = asio::buffer(bulk_->buf.data() + bulk_->filled, bulk_->buf.size() - bulk_->filled);
+        }
+        else {
+            make_room();
+            dst = asio::buffer(in_->buf.data() + in_->filled, in_->buf.size() - in_->filled);
+        }
+        socket_.async_read_some(dst,
+            asio::bind_executor(strand_, [this, self](std::error_code ec, std::size_t n) {
                 if (ec) return;
-                pending_.append(inbuf_.data(), n);
-
-                for (;;) {
-                    auto res = parse_resp(pending_.data(), pending_.size());
-                    if (!res.arr && res.error.empty()) break;       // need more
-                    if (!res.error.empty()) {
-                        asio::post(strand_, [self] { self->enqueue_write("-ERR proto\r\n"); });
-                        pending_.erase(0, res.consumed);
-                        continue;
-                    }
-                    auto args = std::move(res.arr->args);
-                    pending_.erase(0, res.consumed);
-                    handle_frame(args);
+                if (bulk_) {
+                    bulk_->filled += n;
+                    if (bulk_->filled < bulk_->buf.size() || !finish_large_bulk()) { do_read(); return; }
+                }
+                else {
+                    in_->filled += n;
                 }
-                do_read();
-            });
+                parse_input();
+                if (backlogged()) paused_ = true;
+                else do_read();
+            }));
     }
 
-    void Session::handle_frame(const std::vector<std::string>& args) {
-        auto self = shared_from_this();
-        pool_.enqueue([this, self, args] {
-            std::string reply;
-            try {
-                reply = router_.dispatch(args);
-            }
-            catch (const std::exception& e) {
-                reply = resp_error(std::string("server error: ") + e.what());
+    bool Session::backlogged() const {
+        return next_seq_ - next_out_ >= kMaxInFlight || queued_bytes_ >= kMaxQueuedBytes;
+    }
+
+    void Session::resume_read() {
+        if (!paused_ || backlogged()) return;
+        paused_ = false;
+        if (!bulk_) parse_input();                      // frames left unparsed when reading stopped
+        if (backlogged()) paused_ = true;
+        else do_read();
+    }
+
+    void Session::parse_input() {
+        for (;;) {
+            if (backlogged()) return;                   // the rest waits in the chunk
+            Chunk& c = *in_;
+            std::size_t used = 0;
+            auto st = parser_.feed(c.buf.data() + c.parsed, c.filled - c.parsed, used);
+            c.parsed += used;
+            switch (st) {
+            case RespParser::Status::NeedMore:
+                return;
+            case RespParser::Status::Error:
+                protocol_error();
+                return;
+            case RespParser::Status::Frame:
+                handle_frame(parser_.take_args());
+                break;
+            case RespParser::Status::LargeBulk: {
+                // Preallocate the whole body and move over what is already buffered;
+                // the remainder is read directly into it.
+                std::size_t need = parser_.bulk_len() + 2;
+                bulk_ = std::make_shared<Chunk>();
+                bulk_->buf.resize(need);
+                std::size_t have = std::min(need, c.filled - c.parsed);
+                std::memcpy(bulk_->buf.data(), c.buf.data() + c.parsed, have);
+                bulk_->filled = have;
+                c.parsed += have;
+                if (have < need || !finish_large_bulk()) return;
+                break;
             }
-            catch (...) {
-                reply = resp_error("server error");
             }
-            asio::post(strand_, [self, r = std::move(reply)]() mutable {
-                self->enqueue_write(std::move(r));
+        }
+    }
+
+    // Hands a completely read large bulk to the parser; false if parsing cannot continue.
+    bool Session::finish_large_bulk() {
+        std::string_view body(bulk_->buf.data(), bulk_->buf.size());
+        held_.push_back(std::move(bulk_));
+        auto st = parser_.finish_bulk(body);
+        if (st == RespParser::Status::Error) { protocol_error(); return false; }
+        if (st == RespParser::Status::Frame) handle_frame(parser_.take_args());
+        return true;
+    }
+
+    void Session::protocol_error() {
+        complete(next_seq_++, Reply{ "-ERR proto\r\n", {} });
+        // no way to resynchronise inside a stream: drop what is buffered
+        in_->parsed = in_->filled;
+        held_.clear();
+        bulk_.reset();
+        parser_.reset();
+    }
+
+    void Session::handle_frame(std::vector<std::string_view> args) {
+        auto self = shared_from_this();
+        auto held = std::exchange(held_, {});
+        Reply out;
+        if (!free_bufs_.empty()) {
+            out.text = std::move(free_bufs_.back());
+            free_bufs_.pop_back();
+        }
+        const bool idle = next_seq_ == next_out_;          // every earlier reply is out
+        router_.execute(std::move(args), std::move(out), [self, seq = next_seq_++, chunk = in_, held = std::move(held)](Reply reply) mutable {
+            asio::post(self->strand_, [self, seq, chunk = std::move(chunk), held = std::move(held), r = std::move(reply)]() mutable {
+                chunk.reset();                              // release on the strand, before recycling checks
+                held.clear();
+                self->complete(seq, std::move(r));
                 });
-            });
+            }, idle);
     }
 
-    void Session::enqueue_write(std::string msg) {
+    void Session::complete(std::uint64_t seq, Reply reply) {
+        if (seq == next_out_ && reorder_.empty()) {
+            // common case: in order, nothing buffered
+            ++next_out_;
+            enqueue_write(std::move(reply));
+            resume_read();
+            return;
+        }
+        size_t slot = static_cast<size_t>(seq - next_out_);
+        if (reorder_.size() <= slot) reorder_.resize(slot + 1);
+        reorder_[slot] = std::move(reply);
+        while (!reorder_.empty() && reorder_.front()) {
+            enqueue_write(std::move(*reorder_.front()));
+            reorder_.pop_front();
+            ++next_out_;
+        }
+        resume_read();
+    }
+
+    static std::size_t reply_bytes(const Reply& r) {
+        std::size_t size = r.text.size();
+        for (auto& sp : r.splices) size += sp.bytes->size();
+        return size;
+    }
+
+    // What a queued reply holds on to, as counted against kMaxQueuedBytes: many
+    // tiny replies weigh more than their text.
+    static std::size_t reply_footprint(const Reply& r) {
+        return sizeof(Reply) + r.text.capacity() + reply_bytes(r) - r.text.size();
+    }
+
+    void Session::enqueue_write(Reply msg) {
         bool writing = !outq_.empty();
+        queued_bytes_ += reply_footprint(msg);
         outq_.push_back(std::move(msg));
         if (!writing) do_write();
     }
 
     void Session::do_write() {
         auto self = shared_from_this();
-        asio::async_write(socket_, asio::buffer(outq_.front()),
+        // Coalesce queued replies into one writev; always take at least one. A reply
+        // is its text cut at each splice, with the shared payload in between.
+        wbufs_.clear();
+        writing_ = 0;
+        std::size_t bytes = 0;
+        for (auto& m : outq_) {
+            const std::size_t size = reply_bytes(m);
+            const std::size_t nbufs = 1 + 2 * m.splices.size();
+            if (writing_ && (wbufs_.size() + nbufs > kMaxWriteBuffers || bytes + size > kMaxWriteBytes)) break;
+            std::size_t from = 0;
+            for (auto& sp : m.splices) {
+                wbufs_.push_back(asio::buffer(m.text.data() + from, sp.at - from));
+                wbufs_.push_back(asio::buffer(*sp.bytes));
+                from = sp.at;
+            }
+            wbufs_.push_back(asio::buffer(m.text.data() + from, m.text.size() - from));
+            bytes += size;
+            ++writing_;
+        }
+        asio::async_write(socket_, wbufs_,
             asio::bind_executor(strand_,
                 [this, self](std::error_code ec, std::size_t) {
                     if (ec) return;
-                    outq_.pop_front();
+                    for (std::size_t i = 0; i < writing_; ++i) {
+                        queued_bytes_ -= reply_footprint(outq_.front());
+                        std::string& m = outq_.front().text;
+                        if (free_bufs_.size() < kMaxFreeBufs && m.capacity() <= kMaxFreeBufCapacity) {
+                            m.clear();
+                            free_bufs_.push_back(std::move(m));
+                        }
+                        outq_.pop_front();              // drops its references to shared payloads
+                    }
                     if (!outq_.empty()) do_write();
+                    resume_read();
                 }));
     }
 
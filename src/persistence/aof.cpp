@@ -0,0 +1,629 @@
+#include <redisx/persistence/aof.hpp>
+#include <redisx/core/router.hpp>
+#include <redisx/proto/resp.hpp>
+#include <redisx/util/chunk_queue.hpp>
+#include <redisx/util/mapped_file.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <memory>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace redisx {
+
+    bool parse_fsync(std::string_view name, Fsync& out) {
+        if (name == "always") out = Fsync::Always;
+        else if (name == "everysec") out = Fsync::EverySec;
+        else if (name == "no") out = Fsync::No;
+        else return false;
+        return true;
+    }
+
+    long long unix_ms_at(std::chrono::steady_clock::time_point tp) {
+        using namespace std::chrono;
+        const auto left = ceil<milliseconds>(tp - steady_clock::now());
+        return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count() + left.count();
+    }
+
+    static long long steady_ms() {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ---- file access ---------------------------------------------------------
+
+#ifdef _WIN32
+    static int open_append(const std::string& path) {
+        return ::_open(path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+    static int open_new(const std::string& path) {
+        return ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+    static long long write_some(int fd, const char* p, size_t n) { return ::_write(fd, p, static_cast<unsigned>(n)); }
+    static int sync_file(int fd) { return ::_commit(fd); }
+    static void close_file(int fd) { ::_close(fd); }
+    static void sync_dir(const std::string&) {}
+#else
+    static int open_append(const std::string& path) {
+        return ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+    static int open_new(const std::string& path) {
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    static long long write_some(int fd, const char* p, size_t n) { return ::write(fd, p, n); }
+    static int sync_file(int fd) {
+#ifdef __linux__
+        return ::fdatasync(fd);         // the data and the length; timestamps can wait
+#else
+        return ::fsync(fd);
+#endif
+    }
+    static void close_file(int fd) { ::close(fd); }
+    // Makes a rename into the directory of path durable
+    static void sync_dir(const std::string& path) {
+        const std::filesystem::path dir = std::filesystem::path(path).parent_path();
+        if (int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY); fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+#endif
+
+    // Bytes written before an error (all of them if there was none)
+    static size_t write_all(int fd, const char* p, size_t n) {
+        size_t done = 0;
+        while (done < n) {
+            const long long k = write_some(fd, p + done, n - done);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            done += static_cast<size_t>(k);
+        }
+        return done;
+    }
+
+    // ---- encoding ------------------------------------------------------------
+
+    static void put_header(std::string& out, char type, size_t n) {
+        char num[24];
+        auto [end, ec] = std::to_chars(num, num + sizeof(num), n);
+        out.push_back(type);
+        out.append(num, end);
+        out.append("\r\n");
+    }
+
+    static void put_command(std::string& out, std::span<const std::string_view> args) {
+        put_header(out, '*', args.size());
+        for (std::string_view a : args) {
+            put_header(out, '$', a.size());
+            out.append(a);
+            out.append("\r\n");
+        }
+    }
+
+    // Logs of whole shards go to the file in chunks of about this size
+    static constexpr size_t kChunkBytes = 1 << 20;
+
+    // Commands that recreate the shard's live keys: SET, or HSET in runs of at most
+    // kPairsPerCommand fields, then PEXPIREAT if the key expires. Runs on the shard's
+    // thread, calling flush(out) whenever out reaches kChunkBytes.
+    template <class Flush>
+    static void log_shard(const Shard& shard, std::string& out, Flush&& flush) {
+        constexpr size_t kPairsPerCommand = 64;
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<std::string_view> args;
+        auto put = [&](std::span<const std::string_view> cmd) {
+            put_command(out, cmd);
+            if (out.size() >= kChunkBytes) flush(out);
+        };
+        shard.for_each_live(now, [&](const Entry& e) {
+            if (const HashValue* h = e.hash()) {
+                args.assign({ "HSET", e.key });
+                h->for_each([&](std::string_view f, std::string_view v) {
+                    args.push_back(f);
+                    args.push_back(v);
+                    if (args.size() == 2 + 2 * kPairsPerCommand) {
+                        put(args);
+                        args.resize(2);
+                    }
+                });
+                if (args.size() > 2) put(args);
+            }
+            else {
+                const std::string_view cmd[] = { "SET", e.key, *e.str() };
+                put(cmd);
+            }
+            if (e.has_expiry()) {
+                const std::string at = std::to_string(unix_ms_at(e.expires));
+                const std::string_view cmd[] = { "PEXPIREAT", e.key, at };
+                put(cmd);
+            }
+        });
+    }
+
+    // Writes a rewrite's base to path and syncs it. part(i, out, flush) gives shard
+    // i's commands in out, and may call flush(out) to have what it has so far
+    // written and out emptied.
+    template <class Part>
+    static bool write_base(const std::string& path, size_t shards, Part&& part, std::string& error) {
+        const int fd = open_new(path);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        std::string out;
+        bool ok = true;
+        auto flush = [&](std::string& chunk) {
+            ok = ok && write_all(fd, chunk.data(), chunk.size()) == chunk.size();
+            chunk.clear();
+        };
+        for (size_t i = 0; i < shards && ok; ++i) {
+            part(i, out, flush);
+            flush(out);
+        }
+        ok = ok && sync_file(fd) == 0;
+        if (!ok) error = "cannot write " + path + ": " + std::strerror(errno);
+        close_file(fd);
+        return ok;
+    }
+
+    // ---- AppendLog -----------------------------------------------------------
+
+    AppendLog::AppendLog(Store& store, ShardPool& pool, std::string path, Fsync policy)
+        : store_(store), pool_(pool), path_(std::move(path)), policy_(policy) {
+        buffers_.reserve(store.shard_count());
+        for (size_t i = 0; i < store.shard_count(); ++i) buffers_.push_back(std::make_unique<Buffer>());
+    }
+
+    AppendLog::~AppendLog() {
+        if (writer_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                stop_ = true;
+            }
+            cv_.notify_one();
+            writer_.join();
+        }
+        // with the writer gone, nothing can start a rewrite or finish one
+#ifndef _WIN32
+        if (const long long pid = child_.load(); pid > 0) ::kill(static_cast<pid_t>(pid), SIGKILL);
+#endif
+        if (rewriter_.joinable()) rewriter_.join();
+        if (rewriting_.load()) std::remove(rewrite_path().c_str());
+        if (fd_ >= 0) close_file(fd_);
+    }
+
+    bool AppendLog::exists() const {
+        std::error_code ec;
+        return std::filesystem::exists(path_, ec);
+    }
+
+    // Commands run on their shards' threads as the server would run them, so the
+    // commands of a key apply in file order; at most kWindow are queued at a time.
+    // Nothing expires meanwhile: a key that did is followed by its DEL in the file,
+    // and one that had not yet must not be dropped for the time replaying took.
+    bool AppendLog::replay(size_t& commands, std::string& error) {
+        commands = 0;
+        if (!exists()) return true;
+        // mapped, as the snapshot is: the log may be far larger than memory can hold twice
+        auto data = std::make_unique<MappedFile>();
+        if (!data->open(path_)) {
+            error = "cannot read " + path_ + ": " + std::strerror(errno);
+            return false;
+        }
+
+        struct Batch {
+            std::atomic<size_t> left{ 1 };
+            std::promise<void> done;
+            void finish() {
+                if (left.fetch_sub(1) == 1) done.set_value();
+            }
+        };
+        constexpr size_t kWindow = 64 * 1024;
+        auto batch = std::make_shared<Batch>();
+        size_t queued = 0;
+        auto drain = [&] {
+            batch->finish();
+            batch->done.get_future().wait();
+            batch = std::make_shared<Batch>();
+            queued = 0;
+        };
+
+        Router router(store_, pool_);       // without a log: replaying appends nothing
+        store_.set_loading(true);
+        struct Loaded {
+            Store& store;
+            ~Loaded() { store.set_loading(false); }
+        } loaded{ store_ };
+        RespParser parser;
+        size_t pos = 0, good = 0;           // good: the end of the last whole command
+        for (;;) {
+            size_t consumed = 0;
+            const auto status = parser.feed(data->data() + pos, data->size() - pos, consumed);
+            pos += consumed;
+            if (status == RespParser::Status::Frame) {
+                good = pos;
+                ++commands;
+                batch->left.fetch_add(1);
+                router.execute(parser.take_args(), Reply{}, [b = batch](Reply) { b->finish(); });
+                if (++queued == kWindow) drain();
+            }
+            else if (status == RespParser::Status::NeedMore) {
+                break;
+            }
+            else {
+                drain();
+                error = path_ + ": " + parser.error() + " after byte " + std::to_string(good);
+                return false;
+            }
+        }
+        drain();
+        const size_t size = data->size();
+        data.reset();                       // unmapped before the file may be cut
+
+        if (good != size) {
+            std::error_code ec;
+            std::filesystem::resize_file(path_, good, ec);
+            if (ec) {
+                error = path_ + " ends in an incomplete command and cannot be cut: " + ec.message();
+                return false;
+            }
+            std::cerr << "warning: " << path_ << " ended in an incomplete command; cut " << size - good << " bytes off it\n";
+        }
+        return true;
+    }
+
+    bool AppendLog::open(std::string& error) {
+        std::error_code ec;
+        const bool fresh = !exists() || std::filesystem::file_size(path_, ec) == 0;
+        fd_ = open_append(path_);
+        if (fd_ < 0) {
+            error = "cannot open " + path_ + ": " + std::strerror(errno);
+            return false;
+        }
+        if (fresh) {
+            // the shards write out their own keys as SAVE does: as many at a time
+            // as there are cores, each a few chunks ahead of the file, in order
+            const size_t n = store_.shard_count();
+            const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+            const size_t window = std::min(cores, n);
+            std::vector<std::unique_ptr<ChunkQueue>> queues(n);
+            size_t started = 0;
+            auto start = [&] {
+                const size_t i = started++;
+                queues[i] = std::make_unique<ChunkQueue>();
+                pool_.post(i, [&, i] {
+                    ChunkQueue& q = *queues[i];
+                    std::string out;
+                    log_shard(store_.shard_by_index(i), out, [&](std::string& c) { q.push(c); });
+                    if (!out.empty()) q.push(out);
+                    q.close();
+                });
+            };
+            while (started < window) start();
+            bool ok = true;
+            std::string chunk;
+            for (size_t i = 0; i < started; ++i) {
+                ChunkQueue& q = *queues[i];
+                if (!ok) q.abandon();
+                while (q.pop(chunk)) {
+                    if (write_all(fd_, chunk.data(), chunk.size()) != chunk.size()) {
+                        ok = false;
+                        q.abandon();
+                    }
+                }
+                queues[i].reset();
+                if (ok && started < n) start();
+            }
+            if (!ok || sync_file(fd_) != 0) {
+                error = "cannot write " + path_ + ": " + std::strerror(errno);
+                return false;
+            }
+        }
+        const uint64_t size = std::filesystem::file_size(path_, ec);
+        size_.store(ec ? 0 : size);
+        base_size_.store(ec ? 0 : size);
+        // keys that expire or are evicted are logged as deleted, at the point they go
+        store_.on_drop([this](size_t shard, std::string_view key) {
+            const std::string_view cmd[] = { "DEL", key };
+            append(shard, cmd);
+        });
+        writer_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    void AppendLog::append(size_t shard, std::span<const std::string_view> args) {
+        Buffer& b = *buffers_[shard];
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lk(b.mu);
+            was_empty = b.data.empty();
+            const size_t at = b.data.size();
+            put_command(b.data, args);
+            if (b.rewriting) b.since_rewrite.append(b.data, at);
+        }
+        ++b.appended;
+        if (was_empty) wake();      // otherwise a wake-up for these bytes is already due
+    }
+
+    // The bytes f waits for were appended before it. If the writer has taken them
+    // already, f waits for the next batch, which has to be woken for it.
+    void AppendLog::when_durable(size_t shard, std::function<void()> f) {
+        Buffer& b = *buffers_[shard];
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lk(b.mu);
+            was_empty = b.data.empty();
+            b.waiting.push_back(std::move(f));
+        }
+        if (was_empty) wake();
+    }
+
+    void AppendLog::wake() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (pending_) return;
+            pending_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    // Each round takes every shard's buffer, writes them, and syncs as the policy
+    // says. Replies waiting under Fsync::Always are released only once everything
+    // before them is written and synced; a failed write is kept and retried a
+    // second later, so they wait for that too. The round after a rewrite's base is
+    // written also installs the new file, and a round may start a rewrite.
+    void AppendLog::run() {
+        using Clock = std::chrono::steady_clock;
+        std::vector<std::string> taken(buffers_.size());
+        std::vector<std::string> tails(buffers_.size());
+        std::vector<std::function<void()>> waiting;
+        std::string backlog;                // what a failed write left over
+        auto last_sync = Clock::now();
+        Clock::time_point last_auto;        // when the last automatic rewrite was tried
+        bool unsynced = false;
+        bool failing = false;
+        for (;;) {
+            bool stopping;
+            bool finishing = false, base_ok = false;
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait_for(lk, std::chrono::seconds(1), [&] { return pending_ || stop_; });
+                pending_ = false;
+                stopping = stop_;
+                std::swap(finishing, rewrite_done_);
+                base_ok = rewrite_ok_;
+            }
+            for (size_t i = 0; i < buffers_.size(); ++i) {
+                Buffer& b = *buffers_[i];
+                std::lock_guard<std::mutex> lk(b.mu);
+                std::swap(b.data, taken[i]);
+                for (auto& f : b.waiting) waiting.push_back(std::move(f));
+                b.waiting.clear();
+                if (finishing) {
+                    std::swap(b.since_rewrite, tails[i]);
+                    b.rewriting = false;
+                }
+            }
+
+            bool ok = true;
+            auto put = [&](std::string& s) {
+                if (s.empty()) return;
+                const size_t n = ok ? write_all(fd_, s.data(), s.size()) : 0;
+                unsynced |= n != 0;
+                size_.fetch_add(n);
+                if (n != s.size()) {
+                    if (ok && !failing) std::cerr << "cannot write " << path_ << ": " << std::strerror(errno) << "; retrying\n";
+                    ok = false;
+                    backlog.append(s, n);
+                }
+                s.clear();                  // keeps its capacity for the swap back
+            };
+            if (!backlog.empty()) {
+                std::string retry;
+                retry.swap(backlog);
+                put(retry);
+            }
+            for (auto& s : taken) put(s);
+            failing = !ok;
+
+            const auto now = Clock::now();
+            const bool sync = unsynced && policy_ != Fsync::No
+                && (policy_ == Fsync::Always || stopping || now - last_sync >= std::chrono::seconds(1));
+            if (sync) {
+                if (sync_file(fd_) == 0) unsynced = false;
+                else std::cerr << "cannot sync " << path_ << ": " << std::strerror(errno) << "\n";
+                last_sync = now;
+            }
+
+            if (finishing) {
+                const bool installed = base_ok && install_rewrite(tails);
+                if (installed) {
+                    // the new file holds everything, synced, whatever the old one missed
+                    backlog.clear();
+                    ok = true;
+                    failing = unsynced = false;
+                }
+                else {
+                    std::remove(rewrite_path().c_str());
+                }
+                for (auto& t : tails) std::string().swap(t);
+                last_rewrite_ok_.store(installed);
+                last_rewrite_ms_.store(steady_ms() - rewrite_started_ms_.load());
+                rewrite_started_ms_.store(0);
+                rewriting_.store(false);
+            }
+
+            if ((ok && (!unsynced || policy_ != Fsync::Always)) || stopping) {
+                for (auto& f : waiting) f();
+                waiting.clear();
+            }
+            if (stopping) return;
+
+            // auto-aof-rewrite-*, tried at most once a second
+            const uint64_t size = size_.load();
+            const uint64_t base = std::max<uint64_t>(base_size_.load(), 1);
+            if (auto_percent_ != 0 && size >= auto_min_bytes_ && size > base
+                && (size - base) * 100 / base >= auto_percent_
+                && !rewriting_.load() && now - last_auto >= std::chrono::seconds(1)) {
+                last_auto = now;
+                std::string why;
+                if (rewrite_in_background(why)) std::cout << "rewriting " << path_ << " at " << size << " bytes\n";
+                else std::cerr << "cannot rewrite " << path_ << ": " << why << "\n";
+            }
+        }
+    }
+
+    bool AppendLog::rewrite_in_background(std::string& error) {
+        if (rewriting_.exchange(true)) {
+            error = "Background append only file rewriting already in progress";
+            return false;
+        }
+        if (rewriter_.joinable()) rewriter_.join();     // the last one, done already
+        rewrite_started_ms_.store(steady_ms());
+        const size_t n = store_.shard_count();
+#ifdef _WIN32
+        // Each shard writes out its keys and starts keeping what it appends in one
+        // task, so the two meet exactly; the rewrite's thread writes them out in order.
+        // A shard's keys are held whole, as its thread cannot wait on the file while
+        // the server goes on.
+        auto parts = std::make_shared<std::vector<std::string>>(n);
+        auto logged = std::make_shared<std::vector<std::promise<void>>>(n);
+        for (size_t i = 0; i < n; ++i) {
+            pool_.post(i, [this, parts, logged, i] {
+                {
+                    Buffer& b = *buffers_[i];
+                    std::lock_guard<std::mutex> lk(b.mu);
+                    b.rewriting = true;
+                }
+                log_shard(store_.shard_by_index(i), (*parts)[i], [](std::string&) {});
+                (*logged)[i].set_value();
+            });
+        }
+        rewriter_ = std::thread([this, parts, logged, n] {
+            std::string why;
+            const bool ok = write_base(rewrite_path(), n, [&](size_t i, std::string& out, auto&) {
+                (*logged)[i].get_future().wait();
+                out.swap((*parts)[i]);
+            }, why);
+            if (!ok) std::cerr << "background rewrite failed: " << why << "\n";
+            rewritten(ok);
+        });
+        return true;
+#else
+        // Every shard thread waits between commands while the process forks: the
+        // child's image then holds exactly the commands appended before the copies
+        // start.
+        pid_t pid = -1;
+        int fork_errno = 0;
+        pool_.with_all_parked([&] {
+            for (auto& b : buffers_) {
+                std::lock_guard<std::mutex> lk(b->mu);
+                b->rewriting = true;
+            }
+            pid = ::fork();
+            fork_errno = errno;
+            if (pid == 0) {
+                // The child, where only this thread exists; it leaves without running any destructor.
+                std::string why;
+                const bool ok = write_base(rewrite_path(), n, [&](size_t i, std::string& out, auto& flush) {
+                    log_shard(store_.shard_by_index(i), out, flush);
+                }, why);
+                if (!ok) std::fprintf(stderr, "background rewrite failed: %s\n", why.c_str());
+                ::_exit(ok ? 0 : 1);
+            }
+        });
+        if (pid < 0) {
+            error = std::string("cannot fork: ") + std::strerror(fork_errno);
+            for (auto& b : buffers_) {
+                std::lock_guard<std::mutex> lk(b->mu);
+                b->rewriting = false;
+                std::string().swap(b->since_rewrite);
+            }
+            rewrite_started_ms_.store(0);
+            rewriting_.store(false);
+            return false;
+        }
+        child_.store(pid);
+        rewriter_ = std::thread([this, pid] {
+            int status = 0;
+            while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            child_.store(-1);
+            rewritten(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        });
+        return true;
+#endif
+    }
+
+    void AppendLog::rewritten(bool ok) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            rewrite_done_ = true;
+            rewrite_ok_ = ok;
+            pending_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    // The tails go after the base, then the file is synced and renamed over the
+    // old one, which is only closed once that worked.
+    bool AppendLog::install_rewrite(std::vector<std::string>& tails) {
+        const std::string tmp = rewrite_path();
+        const int fd = open_append(tmp);
+        bool ok = fd >= 0;
+        for (size_t i = 0; i < tails.size() && ok; ++i) {
+            ok = write_all(fd, tails[i].data(), tails[i].size()) == tails[i].size();
+        }
+        ok = ok && sync_file(fd) == 0;
+        if (!ok) {
+            std::cerr << "cannot finish rewriting " << path_ << ": " << std::strerror(errno) << "\n";
+            if (fd >= 0) close_file(fd);
+            return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path_, ec);
+        if (ec) {
+            std::cerr << "cannot rename " << tmp << " to " << path_ << ": " << ec.message() << "\n";
+            close_file(fd);
+            return false;
+        }
+        sync_dir(path_);
+        close_file(fd_);
+        fd_ = fd;
+        const uint64_t size = std::filesystem::file_size(path_, ec);
+        size_.store(ec ? 0 : size);
+        base_size_.store(ec ? 0 : size);
+        return true;
+    }
+
+    AppendLog::Status AppendLog::status() const {
+        Status s;
+        const long long started = rewrite_started_ms_.load();
+        s.rewriting = rewriting_.load();
+        s.last_rewrite_ok = last_rewrite_ok_.load();
+        const long long took = last_rewrite_ms_.load();
+        s.last_rewrite_seconds = took < 0 ? -1 : took / 1000;
+        s.current_rewrite_seconds = started != 0 ? (steady_ms() - started) / 1000 : -1;
+        s.current_size = size_.load();
+        s.base_size = base_size_.load();
+        return s;
+    }
+
+} // namespace redisx
@@ -1,2 +1,611 @@
 #include <redisx/persistence/snapshot.hpp>
-// no-op placeholder
+#include <redisx/util/chunk_queue.hpp>
+#include <redisx/util/crc32c.hpp>
+#include <redisx/util/mapped_file.hpp>
+#include <redisx/util/thread_pool.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace redisx {
+
+    static constexpr char kMagic[8] = { 'R', 'D', 'X', 'S', 'N', 'A', 'P', '\0' };
+    static constexpr char kSection = 'S';
+    static constexpr char kEnd = 'E';
+    enum : unsigned char { kString = 0, kHash = 1 };
+
+    static long long unix_ms() {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    static long long steady_ms() {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ---- encoding ------------------------------------------------------------
+
+    static void put_u32(std::string& out, std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+
+    static void put_u64(std::string& out, std::uint64_t v) {
+        for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+
+    static void put_varint(std::string& out, std::uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(0x80 | (v & 0x7f)));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    static void put_bytes(std::string& out, std::string_view s) {
+        put_varint(out, s.size());
+        out.append(s);
+    }
+
+    // Sections go to the file in chunks of about this size, never whole
+    static constexpr size_t kChunkBytes = 1 << 20;
+
+    // One shard's records; runs on the shard's thread. Whenever out reaches
+    // kChunkBytes it goes to flush, which must leave it empty; the rest is left
+    // in out.
+    template <class Flush>
+    static std::uint64_t encode_shard(const Shard& shard, Shard::TimePoint now, std::string& out, Flush&& flush) {
+        std::uint64_t keys = 0;
+        shard.for_each_live(now, [&](const Entry& e) {
+            const HashValue* h = e.hash();
+            out.push_back(static_cast<char>(h ? kHash : kString));
+            std::uint64_t ttl = 0;
+            if (e.has_expiry()) {
+                ttl = static_cast<std::uint64_t>(std::chrono::ceil<std::chrono::milliseconds>(e.expires - now).count()) + 1;
+            }
+            put_varint(out, ttl);
+            put_bytes(out, e.key);
+            if (h) {
+                put_varint(out, h->size());
+                h->for_each([&](std::string_view f, std::string_view v) {
+                    put_bytes(out, f);
+                    put_bytes(out, v);
+                    if (out.size() >= kChunkBytes) flush(out);
+                });
+            }
+            else {
+                put_bytes(out, *e.str());
+            }
+            if (out.size() >= kChunkBytes) flush(out);
+            ++keys;
+        });
+        return keys;
+    }
+
+    // Writes sections to f as their payloads come, chunk by chunk: the header
+    // goes out with the key count and length still zero and is filled in once
+    // the payload and its CRC are written. Every call is false after a failure.
+    class SectionWriter {
+    public:
+        explicit SectionWriter(std::FILE* f) : f_(f) {}
+
+        bool begin(std::uint32_t shard) {
+            shard_ = shard;
+            len_ = 0;
+            crc_ = 0;
+            ok_ = ok_ && std::fgetpos(f_, &header_) == 0;
+            return put_header(0);
+        }
+        bool add(std::string_view chunk) {
+            ok_ = ok_ && std::fwrite(chunk.data(), 1, chunk.size(), f_) == chunk.size();
+            crc_ = crc32c(crc_, chunk.data(), chunk.size());
+            len_ += chunk.size();
+            return ok_;
+        }
+        bool end(std::uint64_t keys) {
+            std::string crc;
+            put_u32(crc, crc_);
+            std::fpos_t after;
+            ok_ = ok_ && std::fwrite(crc.data(), 1, crc.size(), f_) == crc.size()
+                && std::fgetpos(f_, &after) == 0 && std::fsetpos(f_, &header_) == 0;
+            return put_header(keys) && (ok_ = std::fsetpos(f_, &after) == 0);
+        }
+
+    private:
+        bool put_header(std::uint64_t keys) {
+            std::string buf;
+            buf.push_back(kSection);
+            put_u32(buf, shard_);
+            put_u64(buf, keys);
+            put_u64(buf, len_);
+            return ok_ = ok_ && std::fwrite(buf.data(), 1, buf.size(), f_) == buf.size();
+        }
+
+        std::FILE* f_;
+        std::fpos_t header_{};
+        std::uint32_t shard_ = 0;
+        std::uint32_t crc_ = 0;
+        std::uint64_t len_ = 0;
+        bool ok_ = true;
+    };
+
+    // ---- decoding ------------------------------------------------------------
+
+    // Bounds-checked cursor; once a read runs past the end, ok is false and
+    // every later read returns zero/empty.
+    struct Reader {
+        const char* p;
+        const char* end;
+        bool ok = true;
+
+        size_t left() const { return static_cast<size_t>(end - p); }
+        bool take(size_t n) {
+            if (!ok || left() < n) return ok = false;
+            return true;
+        }
+        unsigned char u8() {
+            if (!take(1)) return 0;
+            return static_cast<unsigned char>(*p++);
+        }
+        std::uint64_t fixed(int bytes) {
+            if (!take(static_cast<size_t>(bytes))) return 0;
+            std::uint64_t v = 0;
+            for (int i = 0; i < bytes; ++i) v |= std::uint64_t(static_cast<unsigned char>(*p++)) << (8 * i);
+            return v;
+        }
+        std::uint64_t varint() {
+            std::uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                const unsigned char b = u8();
+                v |= std::uint64_t(b & 0x7f) << shift;
+                if (b < 0x80) return v;
+            }
+            ok = false;
+            return 0;
+        }
+        std::string_view bytes() {
+            const std::uint64_t n = varint();
+            if (!take(n)) return {};
+            std::string_view s(p, n);
+            p += n;
+            return s;
+        }
+    };
+
+    struct Record {
+        unsigned char type = 0;
+        std::uint64_t ttl = 0;
+        std::string_view key;
+        std::string_view value;                 // strings
+    };
+
+    // Parses the record at r; a hash's fields and values go to fields, or are only
+    // skipped if it is null. False if the record does not parse.
+    static bool read_record(Reader& r, Record& rec, std::vector<std::string_view>* fields) {
+        rec.type = r.u8();
+        rec.ttl = r.varint();
+        rec.key = r.bytes();
+        if (rec.type == kString) {
+            rec.value = r.bytes();
+        }
+        else if (rec.type == kHash) {
+            const std::uint64_t n = r.varint();
+            if (n > r.left() / 2) return false;         // each field and value takes a byte at least
+            if (fields) fields->clear();
+            for (std::uint64_t i = 0; i < 2 * n; ++i) {
+                const std::string_view b = r.bytes();
+                if (fields) fields->push_back(b);
+            }
+        }
+        else {
+            return false;
+        }
+        return r.ok;
+    }
+
+    // Adds rec to shard unless its TTL ran out while the server was down; true if it did.
+    static bool restore(Shard& shard, const Record& rec, std::span<const std::string_view> fields,
+                        long long elapsed_ms, Shard::TimePoint now) {
+        auto deadline = Entry::kNoExpiry;
+        if (rec.ttl != 0) {
+            const long long left = static_cast<long long>(rec.ttl - 1) - elapsed_ms;
+            if (left <= 0) return false;
+            deadline = now + std::chrono::milliseconds(left);
+        }
+        if (rec.type == kString) shard.restore(rec.key, rec.value, deadline, now);
+        else shard.restore(rec.key, fields, deadline, now);
+        return true;
+    }
+
+    // A section as found in the file, and which shards its records belong to now.
+    struct Section {
+        std::uint32_t shard = 0;                // the shard it was saved from
+        std::uint64_t keys = 0;
+        const char* data = nullptr;
+        size_t len = 0;
+        std::uint32_t crc = 0;
+        std::uint64_t home = 0;                 // records still owned by the shard of that index
+        std::vector<std::vector<const char*>> strays;   // the others, by the shard owning them
+    };
+
+    enum class Scan { Ok, Checksum, BadRecord };
+
+    // Checks a section and sorts its records by owner, without restoring anything.
+    static Scan scan_section(const Store& store, Section& s) {
+        if (crc32c(0, s.data, s.len) != s.crc) return Scan::Checksum;
+        s.strays.assign(store.shard_count(), {});
+        Reader r{ s.data, s.data + s.len };
+        Record rec;
+        for (std::uint64_t k = 0; k < s.keys; ++k) {
+            const char* at = r.p;
+            if (!read_record(r, rec, nullptr)) return Scan::BadRecord;
+            const size_t owner = store.shard_index(rec.key);
+            if (owner == s.shard) ++s.home;
+            else s.strays[owner].push_back(at);
+        }
+        return r.left() == 0 ? Scan::Ok : Scan::BadRecord;
+    }
+
+    // Restores every record shard i owns, on shard i's thread; the sections have
+    // been scanned, so they parse. Returns how many were restored.
+    static size_t restore_shard(Store& store, size_t i, const std::vector<Section>& sections, long long elapsed_ms) {
+        Shard& shard = store.shard_by_index(i);
+        size_t total = 0;
+        for (const Section& s : sections) total += (s.shard == i ? s.home : 0) + s.strays[i].size();
+        shard.reserve(shard.key_count() + total);
+
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<std::string_view> fields;
+        Record rec;
+        size_t loaded = 0;
+        for (const Section& s : sections) {
+            if (s.shard == i) {
+                Reader r{ s.data, s.data + s.len };
+                for (std::uint64_t k = 0; k < s.keys; ++k) {
+                    read_record(r, rec, &fields);
+                    if (store.shard_index(rec.key) == i) loaded += restore(shard, rec, fields, elapsed_ms, now);
+                }
+            }
+            for (const char* at : s.strays[i]) {
+                Reader r{ at, s.data + s.len };
+                read_record(r, rec, &fields);
+                loaded += restore(shard, rec, fields, elapsed_ms, now);
+            }
+        }
+        return loaded;
+    }
+
+    // ---- Snapshot ------------------------------------------------------------
+
+    Snapshot::~Snapshot() {
+        if (worker_.joinable()) worker_.join();
+    }
+
+#ifndef _WIN32
+    // Memory this process does not share with any other: in a forked child, the
+    // pages either side has written to since the fork (read as Redis does).
+    static std::uint64_t private_dirty_bytes() {
+        std::ifstream in("/proc/self/smaps_rollup");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.rfind("Private_Dirty:", 0) == 0) return std::strtoull(line.c_str() + 14, nullptr, 10) * 1024;
+        }
+        return 0;
+    }
+#endif
+
+    bool Snapshot::save(std::string& error) {
+        if (busy_.exchange(true)) {
+            error = "Background save already in progress";
+            return false;
+        }
+        const std::uint64_t changes = store_.changes();
+        const bool ok = write(error);
+        if (ok) saved(changes);
+        busy_.store(false);
+        return ok;
+    }
+
+    bool Snapshot::save_in_background(std::string& error) {
+        if (busy_.exchange(true)) {
+            error = "Background save already in progress";
+            return false;
+        }
+        if (worker_.joinable()) worker_.join();         // the last one, done already
+#ifdef _WIN32
+        bg_started_ms_.store(steady_ms());
+        const std::uint64_t changes = store_.changes();
+        worker_ = std::thread([this, changes] {
+            std::string why;
+            background_done(write(why), changes, 0);
+        });
+        return true;
+#else
+        int pipefd[2];
+        if (::pipe(pipefd) != 0) {
+            error = std::string("cannot create pipe: ") + std::strerror(errno);
+            busy_.store(false);
+            return false;
+        }
+
+        // Every shard thread waits between commands while the process forks, so
+        // the child sees all of them as of one instant and none mid-write.
+        std::uint64_t changes = 0;
+        pid_t pid = -1;
+        pool_.with_all_parked([&] {
+            changes = store_.changes();
+            bg_started_ms_.store(steady_ms());
+            pid = ::fork();
+            if (pid == 0) {
+                // The child, where only this thread exists. It reports the memory it
+                // ended up copying, and leaves without running any destructor.
+                ::close(pipefd[0]);
+                std::string why;
+                const bool ok = write(why, true);
+                if (!ok) std::fprintf(stderr, "background save failed: %s\n", why.c_str());
+                const std::uint64_t cow = private_dirty_bytes();
+                [[maybe_unused]] const ssize_t sent = ::write(pipefd[1], &cow, sizeof(cow));
+                ::_exit(ok ? 0 : 1);
+            }
+        });
+        ::close(pipefd[1]);
+        if (pid < 0) {
+            error = std::string("cannot fork: ") + std::strerror(errno);
+            ::close(pipefd[0]);
+            bg_started_ms_.store(0);
+            busy_.store(false);
+            return false;
+        }
+        worker_ = std::thread([this, pid, fd = pipefd[0], changes] {
+            std::uint64_t cow = 0;
+            if (::read(fd, &cow, sizeof(cow)) != static_cast<ssize_t>(sizeof(cow))) cow = 0;   // the child died
+            ::close(fd);
+            int status = 0;
+            while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            background_done(WIFEXITED(status) && WEXITSTATUS(status) == 0, changes, static_cast<size_t>(cow));
+        });
+        return true;
+#endif
+    }
+
+    void Snapshot::saved(std::uint64_t changes) {
+        last_save_.store(unix_ms() / 1000);
+        saved_changes_.store(changes);
+    }
+
+    void Snapshot::background_done(bool ok, std::uint64_t changes, size_t cow_bytes) {
+        if (ok) saved(changes);
+        last_bg_ok_.store(ok);
+        last_bg_ms_.store(steady_ms() - bg_started_ms_.load());
+        last_cow_.store(cow_bytes);
+        bg_started_ms_.store(0);
+        busy_.store(false);
+    }
+
+    Snapshot::Status Snapshot::status() const {
+        Status s;
+        const long long started = bg_started_ms_.load();
+        s.background_saving = started != 0;
+        s.last_save = last_save_.load();
+        s.changes_since_save = store_.changes() - saved_changes_.load();
+        s.last_background_ok = last_bg_ok_.load();
+        const long long took = last_bg_ms_.load();
+        s.last_background_seconds = took < 0 ? -1 : took / 1000;
+        s.current_background_seconds = started != 0 ? (steady_ms() - started) / 1000 : -1;
+        s.last_cow_bytes = last_cow_.load();
+        return s;
+    }
+
+    bool Snapshot::write(std::string& error, bool forked) {
+        const std::string tmp = path_ + ".tmp";
+        std::FILE* f = std::fopen(tmp.c_str(), "wb");
+        if (!f) {
+            error = "cannot open " + tmp + ": " + std::strerror(errno);
+            return false;
+        }
+        auto fail = [&](const char* what) {
+            error = std::string(what) + " " + tmp + ": " + std::strerror(errno);
+            std::fclose(f);
+            std::remove(tmp.c_str());
+            return false;
+        };
+
+        const auto now = std::chrono::steady_clock::now();
+        const size_t n = store_.shard_count();
+        std::string buf(kMagic, sizeof(kMagic));
+        put_u32(buf, kVersion);
+        put_u32(buf, static_cast<std::uint32_t>(n));
+        put_u64(buf, static_cast<std::uint64_t>(unix_ms()));
+        if (std::fwrite(buf.data(), 1, buf.size(), f) != buf.size()) return fail("cannot write");
+
+        SectionWriter sections(f);
+        bool written = true;
+        std::string chunk;
+        if (forked) {
+            // The child of a multithreaded process, where only this thread exists
+            // and any lock another thread held may stay taken: it encodes the shards
+            // one after another itself, straight into the file, and starts no thread.
+            for (size_t i = 0; i < n && written; ++i) {
+                written = sections.begin(static_cast<std::uint32_t>(i));
+                const std::uint64_t keys = encode_shard(store_.shard_by_index(i), now, chunk, [&](std::string& out) {
+                    written = written && sections.add(out);
+                    out.clear();
+                });
+                written = written && sections.add(chunk) && sections.end(keys);
+                chunk.clear();
+            }
+        }
+        else {
+            // Shards copy out their own records as many at a time as there are
+            // cores, handing them over a few chunks at a time, and the sections are
+            // written in order as the chunks come: the next shard starts once a
+            // section is written, so memory grows with the encoders, never with the
+            // dataset. If writing fails, no more start, and the encoders still
+            // running are let go and waited for, as they use the queues. No shard
+            // may be parked meanwhile: a later one's encoder could be queued behind
+            // the park while an earlier one waits to be written out.
+            const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+            const size_t window = std::min(cores, n);
+            std::vector<std::unique_ptr<ChunkQueue>> queues(n);
+            std::vector<std::uint64_t> keys(n);
+            size_t started = 0;
+            auto start = [&] {
+                const size_t i = started++;
+                queues[i] = std::make_unique<ChunkQueue>();
+                pool_.post(i, [&, i] {
+                    ChunkQueue& q = *queues[i];
+                    std::string out;
+                    keys[i] = encode_shard(store_.shard_by_index(i), now, out, [&](std::string& c) { q.push(c); });
+                    if (!out.empty()) q.push(out);
+                    q.close();
+                });
+            };
+            pool_.without_parking([&] {
+                while (started < window) start();
+                for (size_t i = 0; i < started; ++i) {
+                    ChunkQueue& q = *queues[i];
+                    if (written) written = sections.begin(static_cast<std::uint32_t>(i));
+                    if (!written) q.abandon();
+                    while (q.pop(chunk)) {
+                        if (!sections.add(chunk)) {
+                            written = false;
+                            q.abandon();
+                        }
+                    }
+                    if (written) written = sections.end(keys[i]);
+                    queues[i].reset();
+                    if (written && started < n) start();
+                }
+            });
+        }
+        if (!written) return fail("cannot write");
+        buf.clear();
+        buf.push_back(kEnd);
+        put_u32(buf, static_cast<std::uint32_t>(n));
+        if (std::fwrite(buf.data(), 1, buf.size(), f) != buf.size() || std::fflush(f) != 0) return fail("cannot write");
+#ifdef _WIN32
+        if (_commit(_fileno(f)) != 0) return fail("cannot sync");
+#else
+        if (fsync(fileno(f)) != 0) return fail("cannot sync");
+#endif
+        if (std::fclose(f) != 0) {
+            error = "cannot write " + tmp + ": " + std::strerror(errno);
+            std::remove(tmp.c_str());
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp, path_, ec);
+        if (ec) {
+            error = "cannot rename " + tmp + " to " + path_ + ": " + ec.message();
+            std::remove(tmp.c_str());
+            return false;
+        }
+#ifndef _WIN32
+        // make the rename itself durable
+        std::filesystem::path dir = std::filesystem::path(path_).parent_path();
+        if (int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY); fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+#endif
+        return true;
+    }
+
+    // Finds the sections one header after another, then checks and sorts them
+    // in parallel on as many threads as there are cores, then has every shard
+    // thread restore its own keys into a keyspace sized for them up front.
+    bool Snapshot::load(size_t& keys, std::string& error) {
+        keys = 0;
+        if (!std::filesystem::exists(path_)) return true;
+        MappedFile file;
+        if (!file.open(path_)) {
+            error = "cannot read " + path_ + ": " + std::strerror(errno);
+            return false;
+        }
+
+        Reader r{ file.data(), file.data() + file.size() };
+        if (!r.take(sizeof(kMagic)) || std::memcmp(r.p, kMagic, sizeof(kMagic)) != 0) {
+            error = path_ + " is not a snapshot";
+            return false;
+        }
+        r.p += sizeof(kMagic);
+        const auto version = static_cast<std::uint32_t>(r.fixed(4));
+        r.fixed(4);                                     // shard count at save time
+        const auto saved_at = static_cast<long long>(r.fixed(8));
+        if (r.ok && version != kVersion) {
+            error = path_ + " has snapshot version " + std::to_string(version) + ", expected " + std::to_string(kVersion);
+            return false;
+        }
+        const long long elapsed_ms = std::max(0LL, unix_ms() - saved_at);
+
+        std::vector<Section> sections;
+        bool complete = false;
+        for (;;) {
+            const unsigned char tag = r.u8();
+            if (!r.ok) break;
+            if (tag == kEnd) {
+                const auto count = static_cast<std::uint32_t>(r.fixed(4));
+                complete = r.ok && count == sections.size() && r.left() == 0;
+                break;
+            }
+            if (tag != kSection) break;
+            Section s;
+            s.shard = static_cast<std::uint32_t>(r.fixed(4));
+            s.keys = r.fixed(8);
+            const std::uint64_t len = r.fixed(8);
+            if (!r.ok || len > r.left() || r.left() - len < 4) break;
+            s.data = r.p;
+            s.len = static_cast<size_t>(len);
+            r.p += len;
+            s.crc = static_cast<std::uint32_t>(r.fixed(4));
+            sections.push_back(std::move(s));
+        }
+        if (!complete) {
+            error = path_ + " is truncated or damaged after section " + std::to_string(sections.size());
+            return false;
+        }
+
+        {
+            const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+            ThreadPool scanners(std::min(cores, std::max<size_t>(sections.size(), 1)));
+            std::vector<std::future<Scan>> scans;
+            scans.reserve(sections.size());
+            for (Section& s : sections) scans.push_back(scanners.enqueue([this, &s] { return scan_section(store_, s); }));
+            for (size_t j = 0; j < scans.size(); ++j) {
+                const Scan result = scans[j].get();
+                if (result != Scan::Ok && error.empty()) {
+                    error = path_ + (result == Scan::Checksum ? ": checksum mismatch in section " : ": bad record in section ")
+                        + std::to_string(j);
+                }
+            }
+            if (!error.empty()) return false;
+        }
+
+        const size_t n = store_.shard_count();
+        std::vector<std::promise<size_t>> restored(n);
+        for (size_t i = 0; i < n; ++i) {
+            pool_.post(i, [&, i] { restored[i].set_value(restore_shard(store_, i, sections, elapsed_ms)); });
+        }
+        for (auto& p : restored) keys += p.get_future().get();
+        return true;
+    }
+
+} // namespace redisx
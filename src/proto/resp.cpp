@@ -1,5 +1,5 @@
 #include <redisx/proto/resp.hpp>
-#include <sstream>
+#include <charconv>
 #include <string_view>
 #include <limits>
 #include <cstdlib>
@@ -24,102 +24,237 @@ namespace redisx {
         return v * sign;
     }
 
-    static inline bool read_line(const char* data, std::size_t len, std::size_t off, std::size_t& line_end) {
-        // find "\r\n" starting at off
-        for (std::size_t i = off; i + 1 < len; ++i) {
-            if (data[i] == '\r' && data[i + 1] == '\n') { line_end = i; return true; }
+    // Longest "*<n>" / "$<n>" header line we accept before giving up on finding CRLF.
+    static constexpr std::size_t kMaxHeaderLine = 32;
+    // Same limits as Redis (1M args, proto-max-bulk-len 512 MB); bulks get preallocated.
+    static constexpr long long kMaxArgs = 1024 * 1024;
+    static constexpr long long kMaxBulk = 512LL * 1024 * 1024;
+
+    enum class Header { Ok, NeedMore, Bad };
+
+    // Parse a "<type><number>\r\n" line at p; used is set to the line length incl. CRLF.
+    static inline Header read_header(const char* p, std::size_t n, long long& v, std::size_t& used) {
+        std::size_t limit = n < kMaxHeaderLine ? n : kMaxHeaderLine;
+        for (std::size_t i = 1; i + 1 < limit; ++i) {
+            if (p[i] == '\r' && p[i + 1] == '\n') {
+                bool ok = false;
+                v = parse_ll(std::string_view{ p + 1, i - 1 }, ok);
+                used = i + 2;
+                return ok ? Header::Ok : Header::Bad;
+            }
         }
-        return false;
+        return n < kMaxHeaderLine ? Header::NeedMore : Header::Bad;
     }
 
-    // Reads a RESP "line" (without the trailing CRLF). Returns {ok, start, end, next_offset}
-    // where [start,end) is the line content, and next_offset points after CRLF.
-    struct Line {
-        bool ok = false;
-        std::size_t start = 0, end = 0, next = 0;
-    };
-    static inline Line get_line(const char* data, std::size_t len, std::size_t off) {
-        Line L;
-        std::size_t e;
-        if (!read_line(data, len, off, e)) return L;
-        L.ok = true; L.start = off; L.end = e; L.next = e + 2; // skip CRLF
-        return L;
+    RespParser::Status RespParser::fail(const char* msg) {
+        error_ = msg;
+        state_ = State::ArrayHeader;
+        args_.clear();
+        return Status::Error;
     }
 
-    // main parser
-    RespParseResult parse_resp(const char* data, std::size_t len) {
-        RespParseResult r;
-        if (len == 0) return r;
-
-        // expect an Array: "*<n>\r\n" then n Bulk strings "$<len>\r\n<data>\r\n"
-        if (data[0] != '*') {
-            // reject inline command
-            r.error = "protocol error: expected array";
-            r.consumed = 0;
-            return r;
-        }
+    void RespParser::reset() {
+        state_ = State::ArrayHeader;
+        remaining_ = 0;
+        bulk_len_ = 0;
+        args_.clear();
+        error_.clear();
+    }
 
-        // read "*<n>\r\n"
-        auto L = get_line(data, len, 1);
-        if (!L.ok) return r; // need more
-        bool ok = false;
-        long long n = parse_ll(std::string_view{ data + 1, L.end - 1 }, ok);
-        if (!ok || n < 0) { r.error = "protocol error: bad array length"; r.consumed = L.next; return r; }
-        std::size_t off = L.next;
-
-        RespArray arr;
-        arr.args.reserve(static_cast<std::size_t>(n));
-        for (long long i = 0; i < n; ++i) {
-            if (off >= len) return r; // need more
-            if (data[off] != '$') { r.error = "protocol error: expected bulk string"; r.consumed = off; return r; }
-            // "$<len>\r\n"
-            auto L2 = get_line(data, len, off + 1);
-            if (!L2.ok) return r; // need more
-            long long blen = parse_ll(std::string_view{ data + off + 1, L2.end - (off + 1) }, ok);
-            if (!ok) { r.error = "protocol error: bad bulk length"; r.consumed = L2.next; return r; }
-            off = L2.next;
-            if (blen == -1) {
-                // Null bulk -> treat as empty arg
-                arr.args.emplace_back();
-                continue;
+    std::vector<std::string_view> RespParser::take_args() {
+        std::vector<std::string_view> out = std::move(args_);
+        args_.clear();
+        return out;
+    }
+
+    RespParser::Status RespParser::feed(const char* data, std::size_t len, std::size_t& consumed) {
+        consumed = 0;
+        for (;;) {
+            const char* p = data + consumed;
+            std::size_t n = len - consumed;
+            switch (state_) {
+            case State::ArrayHeader: {
+                // expect an Array: "*<n>\r\n" then n Bulk strings "$<len>\r\n<data>\r\n"
+                if (n == 0) return Status::NeedMore;
+                if (p[0] != '*') return fail("protocol error: expected array");   // no inline commands
+                long long count = 0;
+                std::size_t used = 0;
+                auto h = read_header(p, n, count, used);
+                if (h == Header::NeedMore) return Status::NeedMore;
+                if (h == Header::Bad || count < 0 || count > kMaxArgs) return fail("protocol error: bad array length");
+                consumed += used;
+                remaining_ = count;
+                args_.clear();
+                args_.reserve(static_cast<std::size_t>(count < 64 ? count : 64));
+                state_ = State::BulkHeader;
+                break;
+            }
+            case State::BulkHeader: {
+                if (remaining_ == 0) { state_ = State::ArrayHeader; return Status::Frame; }
+                if (n == 0) return Status::NeedMore;
+                if (p[0] != '$') return fail("protocol error: expected bulk string");
+                long long blen = 0;
+                std::size_t used = 0;
+                auto h = read_header(p, n, blen, used);
+                if (h == Header::NeedMore) return Status::NeedMore;
+                if (h == Header::Bad) return fail("protocol error: bad bulk length");
+                consumed += used;
+                if (blen == -1) {
+                    // Null bulk -> treat as empty arg
+                    args_.emplace_back();
+                    --remaining_;
+                    break;
+                }
+                if (blen < 0) return fail("protocol error: negative bulk length");
+                if (blen > kMaxBulk) return fail("protocol error: bulk too large");
+                bulk_len_ = static_cast<std::size_t>(blen);
+                if (bulk_len_ >= large_bulk_) { state_ = State::BulkExternal; return Status::LargeBulk; }
+                state_ = State::BulkBody;
+                break;
+            }
+            case State::BulkBody: {
+                // Need bulk_len_ bytes + "\r\n"
+                if (n < bulk_len_ + 2) return Status::NeedMore;
+                if (p[bulk_len_] != '\r' || p[bulk_len_ + 1] != '\n') return fail("protocol error: bulk missing CRLF");
+                args_.emplace_back(p, bulk_len_);
+                consumed += bulk_len_ + 2;
+                --remaining_;
+                state_ = State::BulkHeader;
+                break;
+            }
+            case State::BulkExternal:
+                return Status::LargeBulk;   // waiting for finish_bulk()
             }
-            if (blen < 0) { r.error = "protocol error: negative bulk length"; r.consumed = off; return r; }
-            // Need blen bytes + "\r\n"
-            if (off + static_cast<std::size_t>(blen) + 2 > len) return r; // need more
-            arr.args.emplace_back(data + off, data + off + blen);
-            off += static_cast<std::size_t>(blen);
-            // expect CRLF after bulk
-            if (off + 1 >= len || data[off] != '\r' || data[off + 1] != '\n') { r.error = "protocol error: bulk missing CRLF"; r.consumed = off; return r; }
-            off += 2;
         }
+    }
+
+    RespParser::Status RespParser::finish_bulk(std::string_view body_crlf) {
+        if (state_ != State::BulkExternal || body_crlf.size() != bulk_len_ + 2) return fail("protocol error: bad bulk length");
+        if (body_crlf[bulk_len_] != '\r' || body_crlf[bulk_len_ + 1] != '\n') return fail("protocol error: bulk missing CRLF");
+        args_.push_back(body_crlf.substr(0, bulk_len_));
+        --remaining_;
+        state_ = State::BulkHeader;
+        if (remaining_ == 0) { state_ = State::ArrayHeader; return Status::Frame; }
+        return Status::NeedMore;
+    }
 
-        r.arr = std::move(arr);
-        r.consumed = off;
+    // one-shot wrappers
+    RespViewParseResult parse_resp_views(const char* data, std::size_t len) {
+        RespViewParseResult r;
+        RespParser p;
+        std::size_t used = 0;
+        switch (p.feed(data, len, used)) {
+        case RespParser::Status::Frame:
+            r.args = p.take_args();
+            r.consumed = used;
+            break;
+        case RespParser::Status::Error:
+            r.error = p.error();
+            r.consumed = used;
+            break;
+        default:
+            break;  // need more
+        }
         return r;
     }
 
-    // emitters
-    std::string resp_simple(const std::string& s) { return "+" + s + "\r\n"; }
-    std::string resp_error(const std::string& s) { return "-ERR " + s + "\r\n"; }
+    RespParseResult parse_resp(const char* data, std::size_t len) {
+        auto v = parse_resp_views(data, len);
+        RespParseResult r;
+        r.error = std::move(v.error);
+        r.consumed = v.consumed;
+        if (v.args) {
+            RespArray arr;
+            arr.args.assign(v.args->begin(), v.args->end());
+            r.arr = std::move(arr);
+        }
+        return r;
+    }
+
+    // writer
+    void RespWriter::header(char type, long long n) {
+        char buf[24];
+        buf[0] = type;
+        auto r = std::to_chars(buf + 1, buf + sizeof(buf) - 2, n);
+        *r.ptr++ = '\r';
+        *r.ptr++ = '\n';
+        out_.append(buf, static_cast<std::size_t>(r.ptr - buf));
+    }
+
+    void RespWriter::simple(std::string_view s) {
+        out_.push_back('+');
+        out_.append(s);
+        out_.append("\r\n", 2);
+    }
+
+    void RespWriter::error(std::string_view msg) {
+        out_.append("-ERR ", 5);
+        out_.append(msg);
+        out_.append("\r\n", 2);
+    }
+
+    void RespWriter::bulk(std::string_view s) {
+        header('$', static_cast<long long>(s.size()));
+        out_.append(s);
+        out_.append("\r\n", 2);
+    }
 
-    std::string resp_bulk(const std::string& s) {
-        std::ostringstream o; o << "$" << s.size() << "\r\n" << s << "\r\n"; return o.str();
+    void RespWriter::bulk(const SharedBytes& s) {
+        if (!splices_) return bulk(std::string_view(*s));
+        header('$', static_cast<long long>(s->size()));
+        splices_->push_back({ out_.size(), s });
+        out_.append("\r\n", 2);
     }
 
-    std::string resp_nil() { return "$-1\r\n"; }
+    void RespWriter::append(Reply&& r) {
+        if (!splices_) {
+            // flatten: copy each payload into its place
+            std::size_t from = 0;
+            for (auto& sp : r.splices) {
+                out_.append(r.text, from, sp.at - from);
+                out_.append(*sp.bytes);
+                from = sp.at;
+            }
+            out_.append(r.text, from);
+            return;
+        }
+        const std::size_t base = out_.size();
+        out_.append(r.text);
+        for (auto& sp : r.splices) splices_->push_back({ base + sp.at, std::move(sp.bytes) });
+    }
+
+    void RespWriter::rewind(std::size_t mark) {
+        out_.resize(mark);
+        if (!splices_) return;
+        while (!splices_->empty() && splices_->back().at >= mark) splices_->pop_back();
+    }
 
-    std::string resp_int(long long v) {
-        std::ostringstream o; o << ":" << v << "\r\n"; return o.str();
+    void RespWriter::integer(long long v) {
+        if (v == 0) return raw(reply::zero);
+        if (v == 1) return raw(reply::one);
+        header(':', v);
     }
 
+    void RespWriter::array(std::size_t n) {
+        header('*', static_cast<long long>(n));
+    }
+
+    // emitters
+    std::string resp_simple(std::string_view s) { std::string o; RespWriter(o).simple(s); return o; }
+    std::string resp_error(std::string_view s) { std::string o; RespWriter(o).error(s); return o; }
+    std::string resp_bulk(std::string_view s) { std::string o; RespWriter(o).bulk(s); return o; }
+    std::string resp_nil() { return std::string(reply::nil); }
+    std::string resp_int(long long v) { std::string o; RespWriter(o).integer(v); return o; }
+
     std::string resp_array(const std::vector<std::string>& items, bool as_bulk) {
-        std::ostringstream o; o << "*" << items.size() << "\r\n";
+        std::string o;
+        RespWriter w(o);
+        w.array(items.size());
         for (auto& it : items) {
-            if (as_bulk) o << "$" << it.size() << "\r\n" << it << "\r\n";
-            else         o << it; // (not used now)
+            if (as_bulk) w.bulk(it);
+            else         w.raw(it); // (not used now)
         }
-        return o.str();
+        return o;
     }
 
 } // namespace redisx
-
@@ -1,7 +1,10 @@
 ﻿#include <redisx/time/ttl.hpp>
+#include <redisx/util/string_map.hpp>
 
+#include <array>
+#include <atomic>
 #include <queue>
-#include <unordered_map>
+#include <thread>
 #include <utility>
 #include <memory>
 #include <vector>
@@ -12,119 +15,292 @@
 
 namespace redisx::ttl {
 
+    // One interface per Engine; the owning shard is single-threaded → no locking
+    struct Index::Impl {
+        virtual ~Impl() = default;
+        virtual void set(std::string_view key, TimePt when) = 0;
+        virtual void clear(std::string_view key) = 0;
+        virtual size_t size() const = 0;
+        virtual std::optional<TimePt> next_due() const = 0;
+        virtual void prune() = 0;
+        virtual bool pop_due(TimePt now, std::string& out_key) = 0;
+    };
+
+    // ---- Heap engine ------------------------------------------------------------
+
     // Heap node: (when, key, generation)
     using HeapNode = std::tuple<TimePt, std::string, std::uint64_t>;
 
-    struct Index::Impl {
-        // Single-threaded per shard → no locking
+    struct Index::Heap final : Index::Impl {
+        // Current deadline of a key; heap nodes with another generation are stale
+        struct Current {
+            TimePt when;
+            std::uint64_t gen;
+        };
+
         std::priority_queue<HeapNode, std::vector<HeapNode>, std::greater<HeapNode>> heap;
-        std::unordered_map<std::string, std::uint64_t> gens;   // current gen per key
-        std::unordered_map<std::string, TimePt> expires;       // current expiry per key
+        StringMap<Current> current;                            // keys with a deadline
         std::uint64_t next_gen = 1;                            // monotonically increasing
+
+        // Re-setting deadlines leaves stale nodes behind until they surface; once
+        // they dominate, rebuild the heap from the live deadlines.
+        void maybe_compact() {
+            if (heap.size() < 1024 || heap.size() < 2 * current.size()) return;
+            std::vector<HeapNode> live;
+            live.reserve(current.size());
+            for (auto& [key, c] : current) live.emplace_back(c.when, key, c.gen);
+            heap = decltype(heap)(std::greater<HeapNode>{}, std::move(live));
+        }
+
+        bool is_stale(const HeapNode& n) const {
+            auto it = current.find(std::get<1>(n));
+            return it == current.end() || it->second.gen != std::get<2>(n);
+        }
+
+        // Set/update expiry for key
+        void set(std::string_view key, TimePt when) override {
+            const auto g = ++next_gen;  // fresh generation: old nodes for this key become stale
+            auto it = current.find(key);
+            if (it == current.end()) current.emplace(std::string(key), Current{ when, g });
+            else it->second = { when, g };
+            heap.emplace(when, std::string(key), g);
+            maybe_compact();
+        }
+
+        // Clear expiry for key (PERSIST / SET without TTL / key deleted)
+        void clear(std::string_view key) override {
+            auto it = current.find(key);
+            if (it != current.end()) current.erase(it);   // its heap nodes turn stale
+        }
+
+        size_t size() const override { return current.size(); }
+
+        // Top may be stale, so this can be early but never late
+        std::optional<TimePt> next_due() const override {
+            if (heap.empty()) return std::nullopt;
+            return std::get<0>(heap.top());
+        }
+
+        // Drop stale nodes sitting at the top (cheap, rarely needed)
+        // pop_due naturally ignores stales, so this is optional hygiene.
+        void prune() override {
+            while (!heap.empty() && is_stale(heap.top())) heap.pop();
+        }
+
+        bool pop_due(TimePt now, std::string& out_key) override {
+            prune();
+            if (heap.empty() || std::get<0>(heap.top()) > now) return false;   // nothing due yet
+
+            // Stales were dropped, so the top is the key's current deadline
+            out_key = std::get<1>(heap.top());
+            current.erase(out_key);
+            heap.pop();
+            return true;
+        }
     };
 
-    Index::Index() : impl_(new Impl) {}
-    Index::~Index() { delete impl_; }
-    Index::Index(Index&& o) noexcept : impl_(std::exchange(o.impl_, nullptr)) {}
-    Index& Index::operator=(Index&& o) noexcept {
-        if (this != &o) { delete impl_; impl_ = std::exchange(o.impl_, nullptr); }
-        return *this;
-    }
+    // ---- Timing wheel engine ----------------------------------------------------
 
-    // Set/update expiry for key
-    void Index::set(const std::string& key, TimePt when) {
-        auto& I = *impl_;
-        auto& g = I.gens[key];          // default 0 if new
-        g = ++I.next_gen;               // bump to a fresh generation
-        I.expires[key] = when;
-        I.heap.emplace(when, key, g);   // old nodes for this key become stale
-    }
+    // Four levels of 256 slots at one tick per millisecond: a key sits in level L
+    // while its deadline is less than 256^(L+1) ticks away, in the slot picked by
+    // the deadline's L-th byte, so the wheel reaches 2^32 ms (~49 days) ahead and
+    // later deadlines wait in the farthest slot to be re-filed. Slots are intrusive
+    // lists, so set and clear are one hash probe plus relinking; a higher slot is
+    // cascaded into the levels below when the wheel wraps round to it.
+    struct Index::Wheel final : Index::Impl {
+        static constexpr int kBits = 8;
+        static constexpr int kLevels = 4;
+        static constexpr std::uint64_t kSlots = std::uint64_t(1) << kBits;
+        static constexpr std::uint64_t kMask = kSlots - 1;
+        static constexpr std::uint64_t kReach = std::uint64_t(1) << (kBits * kLevels);
+        static constexpr size_t kReady = kLevels * kSlots;     // list of keys already due
+
+        struct Node {
+            const std::string* key = nullptr;   // the key as stored in `current`
+            TimePt when;
+            std::uint64_t tick = 0;             // first tick at which `when` has passed
+            size_t list = 0;                    // index into lists
+            Node* prev = nullptr;
+            Node* next = nullptr;
+        };
 
-    // Clear expiry for key (PERSIST / SET without TTL)
-    void Index::clear(const std::string& key) {
-        auto& I = *impl_;
-        auto it = I.gens.find(key);
-        if (it != I.gens.end()) {
-            it->second = ++I.next_gen;  // bump so old heap nodes turn stale
+        StringMap<Node> current;                // keys with a deadline; nodes never move
+        std::array<Node*, kReady + 1> lists{};  // slot heads, level by level, then ready
+        TimePt origin = Clock::now();           // start of tick 0
+        std::uint64_t next_tick = 0;            // first tick not processed yet
+
+        std::uint64_t tick_of(TimePt when) const {
+            if (when <= origin) return 0;
+            return static_cast<std::uint64_t>(std::chrono::ceil<Ms>(when - origin).count());
         }
-        I.expires.erase(key);
-    }
 
-    // Next wake-up time if heap not empty
-    std::optional<TimePt> Index::next_due() const {
-        const auto& I = *impl_;
-        if (I.heap.empty()) return std::nullopt;
-        return std::get<0>(I.heap.top());
-    }
+        void link(Node* n, size_t list) {
+            n->list = list;
+            n->prev = nullptr;
+            n->next = lists[list];
+            if (n->next) n->next->prev = n;
+            lists[list] = n;
+        }
 
-    // Drop stale nodes sitting at the top (cheap, rarely needed)
-    // sweep_due naturally ignores stales, so this is optional hygiene.
-    void Index::prune() {
-        auto& I = *impl_;
-        while (!I.heap.empty()) {
-            const auto& n = I.heap.top();
-            const auto& key = std::get<1>(n);
-            const auto  gen = std::get<2>(n);
-            auto it = I.gens.find(key);
-            if (it == I.gens.end() || it->second != gen) {
-                I.heap.pop(); // stale
-                continue;
-            }
-            break;
+        void unlink(Node* n) {
+            if (n->prev) n->prev->next = n->next;
+            else lists[n->list] = n->next;
+            if (n->next) n->next->prev = n->prev;
         }
-    }
 
-    // ---- Internal helper used by sweep_due -------------------------------------
-
-    void Index::pop_due_internal(TimePt now,
-        bool& have_due,
-        bool& valid,
-        std::string& out_key)
-    {
-        auto& I = *impl_;
-        have_due = false;
-        valid = false;
-        out_key.clear();
-
-        // Drop stale nodes at the top
-        while (!I.heap.empty()) {
-            const auto& n = I.heap.top();
-            const auto& key = std::get<1>(n);
-            const auto  gen = std::get<2>(n);
-            auto itg = I.gens.find(key);
-            if (itg == I.gens.end() || itg->second != gen) {
-                I.heap.pop();   // stale node
-                continue;
+        // File n by how far its tick is from next_tick; past deadlines fire next.
+        void place(Node* n) {
+            std::uint64_t t = std::max(n->tick, next_tick);
+            if (t - next_tick >= kReach) t = next_tick + kReach - 1;   // re-filed on cascade
+            const std::uint64_t delta = t - next_tick;
+            int level = 0;
+            while (level + 1 < kLevels && delta >= (std::uint64_t(1) << (kBits * (level + 1)))) ++level;
+            link(n, level * kSlots + ((t >> (kBits * level)) & kMask));
+        }
+
+        void cascade(int level) {
+            const size_t list = level * kSlots + ((next_tick >> (kBits * level)) & kMask);
+            Node* n = std::exchange(lists[list], nullptr);
+            while (n) {
+                Node* following = n->next;
+                place(n);
+                n = following;
             }
-            break;              // top is current for that key
         }
 
-        if (I.heap.empty()) return;
+        // Process next_tick: pull down the higher slots that start at it, then move
+        // its level-0 slot onto the ready list.
+        void advance() {
+            int top = 0;
+            while (top + 1 < kLevels && (next_tick & ((std::uint64_t(1) << (kBits * (top + 1))) - 1)) == 0) ++top;
+            for (int level = top; level > 0; --level) cascade(level);
 
-        // Is the current top due?
-        const auto& n = I.heap.top();
-        const auto& when = std::get<0>(n);
-        const auto& key = std::get<1>(n);
+            Node* n = std::exchange(lists[next_tick & kMask], nullptr);
+            while (n) {
+                Node* following = n->next;
+                link(n, kReady);
+                n = following;
+            }
+            ++next_tick;
+        }
 
-        if (when <= now) {
-            I.heap.pop();
-            // Double-check expiry (may have been cleared/updated)
-            auto it = I.expires.find(key);
-            if (it != I.expires.end() && it->second == when) {
-                have_due = true;
-                valid = true;
-                out_key = key;
-                // Caller (the shard) should check its real expire_at and erase if expired
+        void set(std::string_view key, TimePt when) override {
+            auto it = current.find(key);
+            if (it == current.end()) {
+                it = current.emplace(std::string(key), Node{}).first;
+                it->second.key = &it->first;
             }
             else {
-                // Consumed something (progress), but it was stale; ask caller to loop again.
-                have_due = true;
-                valid = false;
+                unlink(&it->second);
+            }
+            Node& n = it->second;
+            n.when = when;
+            n.tick = tick_of(when);
+            place(&n);
+        }
+
+        void clear(std::string_view key) override {
+            auto it = current.find(key);
+            if (it == current.end()) return;
+            unlink(&it->second);
+            current.erase(it);
+        }
+
+        size_t size() const override { return current.size(); }
+
+        // Earliest deadline of the first occupied slot of each level (in wheel order
+        // from next_tick) - at most kLevels * kSlots heads to look at.
+        std::optional<TimePt> next_due() const override {
+            std::optional<TimePt> best;
+            auto consider = [&](const Node* n) {
+                for (; n; n = n->next) {
+                    if (!best || n->when < *best) best = n->when;
+                }
+            };
+            consider(lists[kReady]);
+            for (int level = 0; level < kLevels; ++level) {
+                // level 0 starts at next_tick itself; higher levels just past it
+                const std::uint64_t from = (next_tick >> (kBits * level)) + (level > 0);
+                for (std::uint64_t i = 0; i < kSlots; ++i) {
+                    const Node* head = lists[level * kSlots + ((from + i) & kMask)];
+                    if (head) { consider(head); break; }
+                }
             }
+            return best;
         }
-        else {
-            have_due = false; // nothing due yet
+
+        void prune() override {}   // cleared keys are unlinked at once; nothing to drop
+
+        bool pop_due(TimePt now, std::string& out_key) override {
+            if (now < origin) return false;
+            const auto last = static_cast<std::uint64_t>(std::chrono::floor<Ms>(now - origin).count());
+            while (!lists[kReady]) {
+                if (current.empty()) {
+                    next_tick = std::max(next_tick, last + 1);  // empty wheel: skip ahead
+                    return false;
+                }
+                if (next_tick > last) return false;
+                advance();
+            }
+            Node* n = lists[kReady];
+            unlink(n);
+            out_key = *n->key;
+            current.erase(out_key);
+            return true;
         }
+    };
+
+    // ---- Coarse clock -----------------------------------------------------------
+
+    // time_since_epoch of the last published now(); 0 while no ticker runs
+    static std::atomic<Clock::rep> g_coarse{ 0 };
+
+    TimePt coarse_now() {
+        const Clock::rep t = g_coarse.load(std::memory_order_relaxed);
+        return t ? TimePt(Clock::duration(t)) : now();
+    }
+
+    struct CoarseTicker::State {
+        std::atomic<bool> stop{ false };
+        std::thread thread;
+    };
+
+    CoarseTicker::CoarseTicker(Ms tick) : state_(new State) {
+        g_coarse.store(now().time_since_epoch().count(), std::memory_order_relaxed);
+        state_->thread = std::thread([s = state_, tick] {
+            while (!s->stop.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(tick);
+                g_coarse.store(now().time_since_epoch().count(), std::memory_order_relaxed);
+            }
+        });
+    }
+
+    CoarseTicker::~CoarseTicker() {
+        state_->stop = true;
+        state_->thread.join();
+        g_coarse.store(0, std::memory_order_relaxed);
+        delete state_;
+    }
+
+    // ---- Index ------------------------------------------------------------------
+
+    Index::Index(Engine engine)
+        : impl_(engine == Engine::Wheel ? static_cast<Impl*>(new Wheel) : new Heap) {}
+    Index::~Index() { delete impl_; }
+    Index::Index(Index&& o) noexcept : impl_(std::exchange(o.impl_, nullptr)) {}
+    Index& Index::operator=(Index&& o) noexcept {
+        if (this != &o) { delete impl_; impl_ = std::exchange(o.impl_, nullptr); }
+        return *this;
+    }
+
+    void Index::set(std::string_view key, TimePt when) { impl_->set(key, when); }
+    void Index::clear(std::string_view key) { impl_->clear(key); }
+    size_t Index::size() const { return impl_->size(); }
+    std::optional<TimePt> Index::next_due() const { return impl_->next_due(); }
+    void Index::prune() { impl_->prune(); }
+
+    bool Index::pop_due(TimePt now, std::string& out_key) {
+        return impl_->pop_due(now, out_key);
     }
 
 } // namespace redisx::ttl
@@ -0,0 +1,55 @@
+#include <redisx/util/crc32c.hpp>
+#include <array>
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define REDISX_CRC32C_SSE42 1
+#endif
+
+namespace redisx {
+
+#ifndef REDISX_CRC32C_SSE42
+    // Slicing-by-8: table k advances a byte's contribution by k further bytes.
+    static constexpr std::array<std::array<std::uint32_t, 256>, 8> kTables = [] {
+        std::array<std::array<std::uint32_t, 256>, 8> t{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82f63b78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (size_t k = 1; k < 8; ++k) {
+            for (size_t i = 0; i < 256; ++i) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+        return t;
+    }();
+#endif
+
+    std::uint32_t crc32c(std::uint32_t crc, const void* data, size_t n) {
+        auto p = static_cast<const unsigned char*>(data);
+        crc = ~crc;
+#ifdef REDISX_CRC32C_SSE42
+        std::uint64_t c = crc;
+        for (; n >= 8; n -= 8, p += 8) {
+            std::uint64_t v;
+            std::memcpy(&v, p, 8);
+            c = _mm_crc32_u64(c, v);
+        }
+        crc = static_cast<std::uint32_t>(c);
+        for (; n; --n) crc = _mm_crc32_u8(crc, *p++);
+#else
+        const auto& t = kTables;
+        for (; n >= 8; n -= 8, p += 8) {
+            std::uint32_t lo, hi;
+            std::memcpy(&lo, p, 4);         // little-endian hosts
+            std::memcpy(&hi, p + 4, 4);
+            lo ^= crc;
+            crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+                ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        }
+        for (; n; --n) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+#endif
+        return ~crc;
+    }
+
+} // namespace redisx
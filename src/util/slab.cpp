@@ -0,0 +1,87 @@
+#include <redisx/util/slab.hpp>
+#include <bit>
+
+namespace redisx {
+
+    SlabArena::~SlabArena() {
+        for (void* s : slabs_) ::operator delete(s, kSlabSize);
+    }
+
+    size_t SlabArena::class_of(size_t n) {
+        if (n <= 128) return n == 0 ? 0 : (n - 1) / 16;
+        const unsigned lg = static_cast<unsigned>(std::bit_width(n - 1)) - 1;   // n - 1 in [2^lg, 2^(lg+1))
+        return 8 + (lg - 7) * 4 + ((n - 1 - (size_t(1) << lg)) >> (lg - 2));
+    }
+
+    size_t SlabArena::class_size(size_t c) {
+        if (c < 8) return (c + 1) * 16;
+        const unsigned lg = 7 + static_cast<unsigned>(c - 8) / 4;
+        return (size_t(1) << lg) + ((c - 8) % 4 + 1) * (size_t(1) << (lg - 2));
+    }
+
+    void* SlabArena::allocate(size_t n) {
+        if (n > kMaxSmall) {
+            void* p = ::operator new(n);
+            add(large_, n);
+            add(used_, n);
+            add(blocks_, 1);
+            return p;
+        }
+        const size_t c = class_of(n);
+        Class& k = classes_[c];
+        void* p;
+        if (k.free) {
+            p = k.free;
+            k.free = k.free->next;
+        }
+        else {
+            p = refill(c);
+        }
+        add(used_, class_size(c));
+        add(blocks_, 1);
+        return p;
+    }
+
+    void SlabArena::deallocate(void* p, size_t n) noexcept {
+        sub(blocks_, 1);
+        if (n > kMaxSmall) {
+            sub(large_, n);
+            sub(used_, n);
+            ::operator delete(p, n);
+            return;
+        }
+        const size_t c = class_of(n);
+        Class& k = classes_[c];
+        k.free = new (p) FreeBlock{ k.free };
+        sub(used_, class_size(c));
+    }
+
+    // Carves the next block from the class's slab, starting a new slab if it is spent.
+    // Room for the new slab's pointer is made first, so that push_back cannot throw
+    // and leak it; doubling keeps that from copying every pointer each time.
+    void* SlabArena::refill(size_t c) {
+        const size_t size = class_size(c);
+        Class& k = classes_[c];
+        if (static_cast<size_t>(k.end - k.next) < size) {
+            if (slabs_.size() == slabs_.capacity()) slabs_.reserve(2 * slabs_.size() + 16);
+            k.next = static_cast<char*>(::operator new(kSlabSize));
+            k.end = k.next + kSlabSize;
+            slabs_.push_back(k.next);
+            add(slab_bytes_, kSlabSize);
+        }
+        void* p = k.next;
+        k.next += size;
+        return p;
+    }
+
+    SlabArena::Stats SlabArena::stats() const {
+        Stats s;
+        s.used = used_.load(std::memory_order_relaxed);
+        s.slabs = slab_bytes_.load(std::memory_order_relaxed);
+        s.large = large_.load(std::memory_order_relaxed);
+        s.blocks = blocks_.load(std::memory_order_relaxed);
+        s.external = external_->load(std::memory_order_relaxed);
+        return s;
+    }
+
+} // namespace redisx